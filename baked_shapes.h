@@ -0,0 +1,232 @@
+#pragma once
+/* Small fixed resolution meshes generated at compile time. The arrays end up in the read only data of the
+   binary and are uploaded as they are, no trigonometry runs at startup. Needs no OpenGL context
+
+   The curves and the generator follow parametric_shape.h step by step, so the results match
+   GenerateParametricPositions/Normals to float precision, bench.cpp checks it */
+#include <cstring>
+#include "glad.h"
+
+/* constexpr Math */
+struct BakedPoint
+{
+    double x = 0, y = 0, z = 0;
+};
+
+constexpr BakedPoint operator+(BakedPoint a, BakedPoint b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+constexpr BakedPoint operator-(BakedPoint a, BakedPoint b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+constexpr BakedPoint operator*(BakedPoint a, double s) { return { a.x * s, a.y * s, a.z * s }; }
+constexpr BakedPoint operator/(BakedPoint a, double s) { return { a.x / s, a.y / s, a.z / s }; }
+
+constexpr double baked_pi = 3.141592653589793;
+//pi/2 split in two so the reduction below keeps the bits a single double drops,
+//cos(-pi/2) comes out as the same 6.1e-17 libm gives instead of 0
+constexpr double baked_half_pi_hi = 1.5707963267948966;
+constexpr double baked_half_pi_lo = 6.123233995736766e-17;
+
+//sin of |r| <= pi/4, Taylor series up to r^17
+constexpr double BakedSinKernel(double r)
+{
+    double r2 = r * r;
+    double sum = 0;
+    double term = r;
+    for (int n = 1; n <= 17; n += 2)
+    {
+        sum += term;
+        term *= -r2 / ((n + 1) * (n + 2));
+    }
+    return sum;
+}
+
+//cos of |r| <= pi/4, up to r^18
+constexpr double BakedCosKernel(double r)
+{
+    double r2 = r * r;
+    double sum = 0;
+    double term = 1;
+    for (int n = 0; n <= 18; n += 2)
+    {
+        sum += term;
+        term *= -r2 / ((n + 1) * (n + 2));
+    }
+    return sum;
+}
+
+//reduces x to r in [-pi/4, pi/4] and the quadrant x = quadrant*pi/2 + r
+constexpr double BakedReduce(double x, long long& quadrant)
+{
+    auto q = x / baked_half_pi_hi;
+    quadrant = static_cast<long long>(q < 0 ? q - 0.5 : q + 0.5);
+    return (x - quadrant * baked_half_pi_hi) - quadrant * baked_half_pi_lo;
+}
+
+constexpr double BakedSin(double x)
+{
+    long long quadrant = 0;
+    auto r = BakedReduce(x, quadrant);
+    switch (quadrant & 3)
+    {
+        case 0: return BakedSinKernel(r);
+        case 1: return BakedCosKernel(r);
+        case 2: return -BakedSinKernel(r);
+        default: return -BakedCosKernel(r);
+    }
+}
+
+constexpr double BakedCos(double x)
+{
+    long long quadrant = 0;
+    auto r = BakedReduce(x, quadrant);
+    switch (quadrant & 3)
+    {
+        case 0: return BakedCosKernel(r);
+        case 1: return -BakedSinKernel(r);
+        case 2: return -BakedCosKernel(r);
+        default: return BakedSinKernel(r);
+    }
+}
+
+//scales x into [0.25, 1) by powers of 4 so a few Newton steps are enough, x > 0
+constexpr double BakedSqrt(double x)
+{
+    double scale = 1;
+    while (x >= 1)
+    {
+        x *= 0.25;
+        scale *= 2;
+    }
+    while (x < 0.25)
+    {
+        x *= 4;
+        scale *= 0.5;
+    }
+    double y = 0.75;
+    for (int i = 0; i < 6; ++i)
+        y = (y + x / y) / 2;
+    return y * scale;
+}
+
+constexpr BakedPoint BakedCross(BakedPoint a, BakedPoint b)
+{
+    return { a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x, a.x * b.y - b.x * a.y };
+}
+
+constexpr BakedPoint BakedNormalize(BakedPoint a)
+{
+    return a / BakedSqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+}
+
+/* Profile Curves, same as the ones in parametric_shape.h */
+constexpr BakedPoint BakedParametricHalfCircle(double t)
+{
+    t -= 0.5;
+    t *= baked_pi;
+    return { BakedCos(t), BakedSin(t) };
+}
+
+constexpr BakedPoint BakedParametricCircle(double t)
+{
+    t *= 2 * baked_pi;
+    return BakedPoint{ BakedCos(t), BakedSin(t) } * 0.25 + BakedPoint{ 0.7, 0 };
+}
+
+constexpr BakedPoint BakedParametricSpikes(double t)
+{
+    t -= 0.5;
+    t *= 2 * baked_pi;
+    int a = 2 + 4 * 4;
+    return (BakedPoint{ BakedCos(t) + BakedSin(a * t) / a, BakedSin(t) + BakedCos(a * t) / a } / 2.) * 0.25 + BakedPoint{ 0.7, 0 };
+}
+
+/* Generator */
+template<int vertical_segments, int rotation_segments>
+struct BakedShape
+{
+    static constexpr int vertex_count = vertical_segments * rotation_segments;
+    static constexpr int element_array_count = rotation_segments * (vertical_segments - 1) * 6;
+
+    //tightly packed vec3s, the layout of glm::vec3
+    float positions[vertex_count * 3] = {};
+    float normals[vertex_count * 3] = {};
+    GLuint indices[element_array_count] = {};
+
+    //rows [r_begin, r_end) into buffers with room for the whole grid, like a VAO::RowGenerator
+    void CopyRows(void* positions_out, void* normals_out, GLuint* indices_out, int r_begin, int r_end) const
+    {
+        auto first_vertex = size_t(r_begin) * vertical_segments * 3;
+        auto vertices = size_t(r_end - r_begin) * vertical_segments * 3;
+        std::memcpy(static_cast<float*>(positions_out) + first_vertex, positions + first_vertex, vertices * sizeof(float));
+        std::memcpy(static_cast<float*>(normals_out) + first_vertex, normals + first_vertex, vertices * sizeof(float));
+
+        auto first_element = size_t(r_begin) * (vertical_segments - 1) * 6;
+        auto elements = size_t(r_end - r_begin) * (vertical_segments - 1) * 6;
+        std::memcpy(indices_out + first_element, indices + first_element, elements * sizeof(GLuint));
+    }
+};
+
+//GenerateGridIndices, GenerateParametricPositions and GenerateParametricNormals over the whole grid. The curve is
+//evaluated once per vertical segment and the rotation once per row, one more of each past both ends for the normals
+template<int vertical_segments, int rotation_segments>
+constexpr BakedShape<vertical_segments, rotation_segments> BakeParametricShape(BakedPoint(*parametric_line)(double))
+{
+    BakedShape<vertical_segments, rotation_segments> shape;
+
+    BakedPoint profile[vertical_segments + 2] = {};
+    for (int v = -1; v <= vertical_segments; ++v)
+        profile[v + 1] = parametric_line(v / double(vertical_segments - 1));
+
+    double rotation_cos[rotation_segments + 2] = {};
+    double rotation_sin[rotation_segments + 2] = {};
+    for (int r = -1; r <= rotation_segments; ++r)
+    {
+        auto angle = r / double(rotation_segments) * (2 * baked_pi);
+        rotation_cos[r + 1] = BakedCos(angle);
+        rotation_sin[r + 1] = BakedSin(angle);
+    }
+
+    //glm::rotateY of the profile points, one row past each end as well
+    BakedPoint surface[rotation_segments + 2][vertical_segments + 2] = {};
+    for (int r = 0; r < rotation_segments + 2; ++r)
+        for (int v = 0; v < vertical_segments + 2; ++v)
+            surface[r][v] = { profile[v].x * rotation_cos[r], profile[v].y, -profile[v].x * rotation_sin[r] };
+
+    int vertex = 0;
+    for (int r = 1; r <= rotation_segments; ++r)
+        for (int v = 1; v <= vertical_segments; ++v, vertex += 3)
+        {
+            auto p = surface[r][v];
+            auto tangent_v = ((surface[r][v + 1] - p) + (p - surface[r][v - 1])) / 2.;
+            auto tangent_r = ((surface[r + 1][v] - p) + (p - surface[r - 1][v])) / 2.;
+            auto normal = BakedNormalize(BakedCross(tangent_r, tangent_v));
+
+            shape.positions[vertex] = static_cast<float>(p.x);
+            shape.positions[vertex + 1] = static_cast<float>(p.y);
+            shape.positions[vertex + 2] = static_cast<float>(p.z);
+            shape.normals[vertex] = static_cast<float>(normal.x);
+            shape.normals[vertex + 1] = static_cast<float>(normal.y);
+            shape.normals[vertex + 2] = static_cast<float>(normal.z);
+        }
+
+    //same winding as GenerateGridIndices, the last row wraps around to the first
+    int element = 0;
+    for (int r = 0; r < rotation_segments; ++r)
+        for (int v = 0; v < vertical_segments - 1; ++v)
+        {
+            auto row = GLuint(r * vertical_segments + v);
+            auto next_row = GLuint((r + 1) % rotation_segments * vertical_segments + v);
+            shape.indices[element++] = row + 1;
+            shape.indices[element++] = next_row;
+            shape.indices[element++] = row;
+
+            shape.indices[element++] = row + 1;
+            shape.indices[element++] = next_row + 1;
+            shape.indices[element++] = next_row;
+        }
+
+    return shape;
+}
+
+/* The meshes of scenes 0-5, see shape_VAO, shape1_VAO and shape3_VAO in main.cpp */
+static constexpr auto BakedCircle16x16 = BakeParametricShape<16, 16>(BakedParametricCircle);
+static constexpr auto BakedHalfCircle16x16 = BakeParametricShape<16, 16>(BakedParametricHalfCircle);
+static constexpr auto BakedSpikes12x6 = BakeParametricShape<12, 6>(BakedParametricSpikes);
@@ -0,0 +1,460 @@
+/* Microbenchmarks for the geometry and transform hot paths, no window or OpenGL context needed
+
+   c++ -std=c++17 -O2 bench.cpp -o bench
+   ./bench [--max-resolution 2048] [--json results.json] [--baseline baseline.json] [--threshold 10]
+
+   --json writes the results, so a run on a given machine can be kept as its baseline.
+   --baseline compares against such a file and fails if anything got slower than the threshold (percent). */
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include "parametric_shape.h"
+#include "picking.h"
+#include "curve_expression.h"
+#include "baked_shapes.h"
+
+/* Allocation counting */
+//every form of new and delete is replaced so the pairs match. The allocations go through the two functions below,
+//kept out of line so the compiler does not see new paired with free and warn about it
+static std::atomic<long long> allocation_count(0);
+
+__attribute__((noinline)) static void* CountedAllocate(size_t size)
+{
+    ++allocation_count;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) static void CountedFree(void* p) noexcept
+{
+    std::free(p);
+}
+
+void* operator new(size_t size) { return CountedAllocate(size); }
+void* operator new[](size_t size) { return CountedAllocate(size); }
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+
+/* Measurement */
+struct Result
+{
+    std::string name;
+    int runs;
+    double seconds_per_run;
+    double items_per_run;
+    double allocations_per_run;
+};
+
+static volatile size_t sink;
+
+//repeats fn until it ran for at least min_seconds and keeps the fastest run
+template<typename F>
+Result Measure(const std::string& name, double items_per_run, F fn, double min_seconds = 0.25)
+{
+    using clock = std::chrono::steady_clock;
+
+    Result result = { name, 0, 1e30, items_per_run, 0 };
+    long long allocations = 0;
+    double total = 0;
+    while (total < min_seconds || result.runs < 3)
+    {
+        auto allocations_before = allocation_count.load();
+        auto start = clock::now();
+        fn();
+        auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+        allocations += allocation_count.load() - allocations_before;
+
+        result.seconds_per_run = std::min(result.seconds_per_run, seconds);
+        total += seconds;
+        ++result.runs;
+
+        //the big meshes take seconds on their own, one run is enough
+        if (seconds > min_seconds)
+            break;
+    }
+    result.allocations_per_run = double(allocations) / result.runs;
+
+    std::cout << name << ": " << result.seconds_per_run * 1000 << " ms/run, "
+              << items_per_run / result.seconds_per_run / 1e6 << " M items/s, "
+              << result.allocations_per_run << " allocations/run (" << result.runs << " runs)" << std::endl;
+    return result;
+}
+
+/* Baseline files */
+void WriteJson(const char* path, const std::vector<Result>& results)
+{
+    std::ofstream file(path);
+    file << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& result = results[i];
+        file << "    {\"name\": \"" << result.name << "\""
+             << ", \"seconds_per_run\": " << result.seconds_per_run
+             << ", \"items_per_second\": " << result.items_per_run / result.seconds_per_run
+             << ", \"allocations_per_run\": " << result.allocations_per_run
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+//reads back the one benchmark per line layout of WriteJson
+std::vector<Result> ReadJson(const char* path)
+{
+    std::vector<Result> results;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto name = line.find("\"name\": \"");
+        auto seconds = line.find("\"seconds_per_run\": ");
+        if (name == std::string::npos || seconds == std::string::npos)
+            continue;
+
+        name += 9;
+        Result result = {};
+        result.name = line.substr(name, line.find('"', name) - name);
+        result.seconds_per_run = std::atof(line.c_str() + seconds + 19);
+        results.push_back(result);
+    }
+    return results;
+}
+
+//prints every benchmark that got slower than threshold percent and returns how many did
+int CompareToBaseline(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold)
+{
+    int regressions = 0;
+    for (const auto& result : results)
+        for (const auto& base : baseline)
+            if (base.name == result.name)
+            {
+                auto change = (result.seconds_per_run / base.seconds_per_run - 1) * 100;
+                if (change > threshold)
+                {
+                    std::cout << "REGRESSION " << result.name << ": " << change << "% slower than baseline" << std::endl;
+                    ++regressions;
+                }
+            }
+    return regressions;
+}
+
+/* Adaptive sampling report */
+//triangle count against error for uniform grids and for adaptive meshes aiming at the same errors
+void ReportAdaptiveSampling(glm::dvec2(*parametric_line)(double), const char* name)
+{
+    for (int resolution = 64; resolution <= 1024; resolution *= 2)
+    {
+        auto uniform_error = SampledSurfaceError(parametric_line, UniformProfileSamples(resolution), resolution);
+
+        std::vector<double> profile_samples;
+        auto rotation_segments = AdaptiveSurfaceSamples(profile_samples, parametric_line, uniform_error, glm::radians(10.), resolution, resolution);
+        auto adaptive_error = SampledSurfaceError(parametric_line, profile_samples, rotation_segments);
+
+        auto uniform_triangles = 2. * resolution * (resolution - 1);
+        auto adaptive_triangles = 2. * rotation_segments * (profile_samples.size() - 1);
+        std::cout << name << " " << resolution << "x" << resolution << ": "
+                  << uniform_triangles << " triangles, error " << uniform_error << " | adaptive "
+                  << profile_samples.size() << "x" << rotation_segments << ": "
+                  << adaptive_triangles << " triangles, error " << adaptive_error
+                  << " (" << uniform_triangles / adaptive_triangles << "x fewer)" << std::endl;
+    }
+}
+
+/* Baked Shapes */
+template<int vertical_segments, int rotation_segments>
+bool CheckBakedShape(std::vector<Result>& results, const char* name, const BakedShape<vertical_segments, rotation_segments>& shape,
+                     glm::dvec2(*parametric_line)(double))
+{
+    std::vector<glm::vec3> positions(shape.vertex_count);
+    std::vector<glm::vec3> normals(shape.vertex_count);
+    std::vector<GLuint> indices(shape.element_array_count);
+    GenerateParametricPositions(positions.data(), parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+    GenerateParametricNormals(normals.data(), parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+    GenerateGridIndices(indices.data(), vertical_segments, rotation_segments, 0, rotation_segments);
+
+    double position_difference = 0;
+    double normal_difference = 0;
+    for (int i = 0; i < shape.vertex_count; ++i)
+    {
+        auto baked_position = glm::vec3(shape.positions[i * 3], shape.positions[i * 3 + 1], shape.positions[i * 3 + 2]);
+        auto baked_normal = glm::vec3(shape.normals[i * 3], shape.normals[i * 3 + 1], shape.normals[i * 3 + 2]);
+        position_difference = std::max(position_difference, double(glm::length(baked_position - positions[i])));
+        normal_difference = std::max(normal_difference, double(glm::length(baked_normal - normals[i])));
+    }
+    bool same_indices = std::equal(indices.begin(), indices.end(), shape.indices);
+
+    auto size = std::to_string(vertical_segments) + "x" + std::to_string(rotation_segments);
+    std::cout << "baked " << name << "/" << size << ": max position difference " << position_difference
+              << ", max normal difference " << normal_difference << (same_indices ? "" : ", indices differ") << std::endl;
+    if (!same_indices || position_difference > 1e-5 || normal_difference > 1e-5)
+    {
+        std::cout << "Error: Baked " << name << " does not match the runtime generator" << std::endl;
+        return false;
+    }
+
+    results.push_back(Measure(std::string("baked/runtime/") + name + "/" + size, shape.vertex_count, [&]()
+    {
+        GenerateParametricPositions(positions.data(), parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+        GenerateParametricNormals(normals.data(), parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+        GenerateGridIndices(indices.data(), vertical_segments, rotation_segments, 0, rotation_segments);
+        sink = size_t(positions[1].x * 1000);
+    }));
+    results.push_back(Measure(std::string("baked/copy/") + name + "/" + size, shape.vertex_count, [&]()
+    {
+        shape.CopyRows(positions.data(), normals.data(), indices.data(), 0, rotation_segments);
+        sink = size_t(positions[1].x * 1000);
+    }));
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int max_resolution = 2048;
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    double threshold = 10;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (i + 1 == argc)
+        {
+            std::cout << "Error: " << option << " needs a value" << std::endl;
+            return -1;
+        }
+        if (option == "--max-resolution")
+            max_resolution = std::atoi(argv[i + 1]);
+        else if (option == "--json")
+            json_path = argv[i + 1];
+        else if (option == "--baseline")
+            baseline_path = argv[i + 1];
+        else if (option == "--threshold")
+            threshold = std::atof(argv[i + 1]);
+        else
+        {
+            std::cout << "Error: Unknown option " << option << std::endl;
+            return -1;
+        }
+    }
+
+    std::vector<Result> results;
+
+    for (int resolution = 16; resolution <= max_resolution; resolution *= 2)
+    {
+        auto size = std::to_string(resolution) + "x" + std::to_string(resolution);
+        double vertices = double(resolution) * resolution;
+
+        for (const auto& curve : ParametricCurves)
+        {
+            results.push_back(Measure(std::string("shape/") + curve.name + "/" + size, vertices, [&]()
+            {
+                std::vector<glm::vec3> positions;
+                std::vector<glm::vec3> normals;
+                std::vector<GLuint> indices;
+                GenerateParametricShape(positions, normals, indices, curve.parametric_line, resolution, resolution);
+                sink = positions.size() + normals.size() + indices.size();
+            }));
+
+            results.push_back(Measure(std::string("normals/") + curve.name + "/" + size, vertices, [&]()
+            {
+                std::vector<glm::vec3> normals;
+                GenerateParametricNormals(normals, curve.parametric_line, resolution, resolution);
+                sink = normals.size();
+            }));
+        }
+
+        results.push_back(Measure("indices/" + size, vertices, [&]()
+        {
+            std::vector<GLuint> indices;
+            GenerateGridIndices(indices, resolution, resolution);
+            sink = indices.size();
+        }));
+
+        //the wireframe of scenes 0 and 1, half the lines of the triangle list in GL_LINE polygon mode
+        results.push_back(Measure("edges/" + size, vertices, [&]()
+        {
+            std::vector<GLuint> edges;
+            GenerateGridEdges(edges, resolution, resolution);
+            sink = edges.size();
+        }));
+    }
+
+    //adaptive meshes with the error of the uniform 1024x1024 one, the scene 6 setup, sampling included
+    for (const auto& curve : ParametricCurves)
+    {
+        auto error = SampledSurfaceError(curve.parametric_line, UniformProfileSamples(1024), 1024);
+        std::vector<double> profile_samples;
+        auto rotation_segments = AdaptiveSurfaceSamples(profile_samples, curve.parametric_line, error, glm::radians(10.), 1024, 1024);
+        double vertices = double(profile_samples.size()) * rotation_segments;
+
+        results.push_back(Measure(std::string("adaptive/") + curve.name, vertices, [&]()
+        {
+            std::vector<double> samples;
+            AdaptiveSurfaceSamples(samples, curve.parametric_line, error, glm::radians(10.), 1024, 1024);
+            std::vector<glm::vec3> positions(static_cast<size_t>(vertices));
+            std::vector<glm::vec3> normals(static_cast<size_t>(vertices));
+            GenerateSampledPositions(positions.data(), curve.parametric_line, samples, rotation_segments, 0, rotation_segments);
+            GenerateSampledNormals(normals.data(), curve.parametric_line, samples, rotation_segments, 0, rotation_segments);
+            sink = positions.size() + normals.size();
+        }));
+    }
+
+    //the built-in curves written as expressions, compiled bytecode against the compiled lambdas
+    static const struct { const char* name; const char* source; } expressions[] = {
+        { "halfcircle", "s = (t - 0.5) * pi; x = cos(s); y = sin(s)" },
+        { "circle", "s = 2*pi*t; x = cos(s) * 0.25 + 0.7; y = sin(s) * 0.25" },
+        { "spikes", "a = 2 + 4*4; s = (t - 0.5) * 2*pi; x = (cos(s) + sin(a*s)/a) / 2 * 0.25 + 0.7; y = (sin(s) + cos(a*s)/a) / 2 * 0.25" },
+        { "spikycircle", "a = 1 + 2*6; s = 2*pi*t; x = (cos(s) + sin(a*s)/a) * 0.35 + 0.6; y = (sin(s) + cos(a*s)/a) * 0.35" },
+    };
+    for (const auto& expression : expressions)
+    {
+        ExpressionCurve curve;
+        std::string error;
+        if (!curve.Compile(expression.source, error))
+        {
+            std::cout << "Error: " << expression.name << ": " << error << std::endl;
+            return -1;
+        }
+
+        auto parametric_line = ParametricCurves[0].parametric_line;
+        for (const auto& builtin : ParametricCurves)
+            if (std::string(builtin.name) == expression.name)
+                parametric_line = builtin.parametric_line;
+
+        const int count = 1 << 20;
+        std::vector<double> t(count);
+        for (int i = 0; i < count; ++i)
+            t[i] = i / double(count - 1);
+        std::vector<glm::dvec2> points(count);
+
+        double difference = 0;
+        curve.Evaluate(t.data(), points.data(), count);
+        for (int i = 0; i < count; ++i)
+            difference = std::max(difference, glm::length(points[i] - parametric_line(t[i])));
+        std::cout << "expression " << expression.name << ": " << curve.code.size() << " instructions, "
+                  << curve.register_count << " registers, max difference " << difference << std::endl;
+
+        results.push_back(Measure(std::string("curve/lambda/") + expression.name, count, [&]()
+        {
+            for (int i = 0; i < count; ++i)
+                points[i] = parametric_line(t[i]);
+            sink = size_t(points[count / 3].x * 1000);
+        }));
+
+        results.push_back(Measure(std::string("curve/bytecode/") + expression.name, count, [&]()
+        {
+            curve.Evaluate(t.data(), points.data(), count);
+            sink = size_t(points[count / 3].x * 1000);
+        }));
+    }
+
+    //a whole mesh from an expression, the profile is tabulated once and rotated
+    {
+        ExpressionCurve curve;
+        std::string error;
+        curve.Compile(expressions[3].source, error);
+        int resolution = std::min(max_resolution, 1024);
+        auto size = std::to_string(resolution) + "x" + std::to_string(resolution);
+        double vertices = double(resolution) * resolution;
+
+        results.push_back(Measure("shape/expression/spikycircle/" + size, vertices, [&]()
+        {
+            auto profile = curve.Profile(resolution);
+            std::vector<glm::vec3> positions(static_cast<size_t>(vertices));
+            std::vector<glm::vec3> normals(static_cast<size_t>(vertices));
+            std::vector<GLuint> indices;
+            GenerateProfilePositions(positions.data(), profile, resolution, 0, resolution);
+            GenerateProfileNormals(normals.data(), profile, resolution, 0, resolution);
+            GenerateGridIndices(indices, resolution, resolution);
+            sink = positions.size() + normals.size() + indices.size();
+        }));
+    }
+
+    //the meshes baked at compile time have to match the runtime generator, and copying them is all that is left
+    if (!CheckBakedShape(results, "circle", BakedCircle16x16, ParametricCircle)
+        || !CheckBakedShape(results, "halfcircle", BakedHalfCircle16x16, ParametricHalfCircle)
+        || !CheckBakedShape(results, "spikes", BakedSpikes12x6, ParametricSpikes))
+        return -1;
+
+    //picking on the scene 6 mesh, one item is one triangle for the build and one ray for the queries
+    {
+        int resolution = std::min(max_resolution, 1024);
+        auto size = std::to_string(resolution) + "x" + std::to_string(resolution);
+        MeshBVH bvh;
+        GenerateParametricPositions(bvh.positions, ParametricSpikyCircle, resolution, resolution);
+        GenerateGridIndices(bvh.indices, resolution, resolution);
+        double triangles = bvh.indices.size() / 3.;
+
+        results.push_back(Measure("bvh/build/" + size, triangles, [&]()
+        {
+            BuildMeshBVH(bvh);
+            sink = bvh.nodes.size();
+        }));
+
+        //a grid of cursor rays over the scene 6 view
+        const int rays = 10000;
+        glm::mat4 transform(1.0);
+        transform = glm::scale(transform, glm::vec3(0.6));
+        transform = glm::rotate(transform, glm::radians(30.f), glm::vec3(1, 1, 0));
+        size_t hits = 0;
+        results.push_back(Measure("bvh/pick/" + size, rays, [&]()
+        {
+            hits = 0;
+            for (int i = 0; i < rays; ++i)
+            {
+                auto ndc = glm::vec2(float(i % 100) / 50 - 1, float(i / 100) / 50 - 1);
+                glm::vec3 origin, direction;
+                CursorRay(transform, ndc, origin, direction);
+                hits += IntersectMeshBVH(bvh, origin, direction, 1).hit;
+            }
+            sink = hits;
+        }));
+        std::cout << "bvh " << size << ": " << bvh.nodes.size() << " nodes for " << triangles << " triangles, "
+                  << hits << " of " << rays << " rays hit" << std::endl;
+    }
+
+    //one item is one frame worth of the scene 0-4 transforms
+    const int frames = 100000;
+    results.push_back(Measure("transforms/grid", frames, [&]()
+    {
+        glm::mat4 transform, transform2, transform3, transform4;
+        float sum = 0;
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            GridTransforms(frame / 60., transform, transform2, transform3, transform4);
+            sum += transform[3][0] + transform2[3][0] + transform3[3][0] + transform4[3][0];
+        }
+        sink = size_t(sum);
+    }));
+
+    for (const auto& curve : ParametricCurves)
+        ReportAdaptiveSampling(curve.parametric_line, curve.name);
+
+    if (json_path != NULL)
+        WriteJson(json_path, results);
+
+    if (baseline_path != NULL)
+    {
+        auto baseline = ReadJson(baseline_path);
+        if (baseline.empty())
+        {
+            std::cout << "Error: No benchmarks in " << baseline_path << std::endl;
+            return -1;
+        }
+
+        if (CompareToBaseline(results, baseline, threshold) > 0)
+            return 1;
+        std::cout << "No regressions above " << threshold << "%" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,590 @@
+#pragma once
+/* Profile curves given as text at runtime. Needs no OpenGL context
+
+   a = 1 + 2*6; s = 2*pi*t
+   x = (cos(s) + sin(a*s)/a) * 0.35 + 0.6
+   y = (sin(s) + cos(a*s)/a) * 0.35
+
+   Statements are separated by ';' or new lines, x and y have to be assigned, t runs over [0, 1].
+   The expressions are constant folded, identical subexpressions are merged, and the result is compiled
+   to a register bytecode. Each instruction runs over a whole batch of t values, so the arithmetic loops
+   vectorize and the dispatch cost is shared by the batch */
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "GLM/glm.hpp"
+#include "GLM/gtc/constants.hpp"
+#include "GLM/gtx/rotate_vector.hpp"
+
+struct ExpressionCurve
+{
+    enum Op : uint8_t
+    {
+        op_constant, op_t,
+        op_add, op_sub, op_mul, op_div, op_pow, op_min, op_max, op_atan2,
+        op_neg, op_sin, op_cos, op_tan, op_asin, op_acos, op_atan, op_sqrt, op_abs, op_exp, op_log, op_floor,
+        //sine into destination and cosine into b, of the same argument
+        op_sincos
+    };
+
+    struct Node
+    {
+        Op op;
+        int a, b;
+        double value;
+    };
+
+    struct Instruction
+    {
+        Op op;
+        uint8_t destination, a, b;
+    };
+
+    static const int batch_size = 64;
+    static const int max_registers = 256;
+
+    //register 0 holds t, constants follow and never change
+    std::vector<Instruction> code;
+    std::vector<double> constants;
+    int register_count = 0;
+    int x_register = 0;
+    int y_register = 0;
+
+    //false and a message in error if source does not compile
+    bool Compile(const std::string& source, std::string& error)
+    {
+        Parser parser(source);
+        int x = -1, y = -1;
+        if (!parser.Program(x, y))
+        {
+            error = parser.error;
+            return false;
+        }
+        return Emit(parser.nodes, x, y, error);
+    }
+
+    glm::dvec2 operator()(double t) const
+    {
+        glm::dvec2 point;
+        Evaluate(&t, &point, 1);
+        return point;
+    }
+
+    //the curve at count values of t
+    void Evaluate(const double* t, glm::dvec2* points, size_t count) const
+    {
+        //one buffer per thread, reused across calls and curves, it only grows. Evaluate runs on the worker threads
+        //and once per point through operator(), so it must not allocate. Lanes past count are never read
+        thread_local std::vector<double> registers;
+        if (registers.size() < size_t(register_count) * batch_size)
+            registers.resize(size_t(register_count) * batch_size);
+        auto lanes = std::min<size_t>(batch_size, count);
+        for (size_t i = 0; i < constants.size(); ++i)
+            std::fill_n(registers.data() + (i + 1) * batch_size, lanes, constants[i]);
+
+        for (size_t start = 0; start < count; start += batch_size)
+        {
+            auto n = int(std::min<size_t>(batch_size, count - start));
+            std::copy(t + start, t + start + n, registers.data());
+
+            for (const auto& instruction : code)
+                Run(instruction, registers.data(), n);
+
+            const double* x = registers.data() + x_register * batch_size;
+            const double* y = registers.data() + y_register * batch_size;
+            for (int i = 0; i < n; ++i)
+                points[start + i] = glm::dvec2(x[i], y[i]);
+        }
+    }
+
+    //vertical_segments samples over [0, 1] with one more past each end, for GenerateProfilePositions and Normals
+    std::vector<glm::dvec2> Profile(int vertical_segments) const
+    {
+        std::vector<double> t(vertical_segments + 2);
+        for (int v = -1; v <= vertical_segments; ++v)
+            t[v + 1] = v / double(vertical_segments - 1);
+
+        std::vector<glm::dvec2> profile(t.size());
+        Evaluate(t.data(), profile.data(), t.size());
+        return profile;
+    }
+
+    static double Apply(Op op, double a, double b)
+    {
+        switch (op)
+        {
+        case op_add: return a + b;
+        case op_sub: return a - b;
+        case op_mul: return a * b;
+        case op_div: return a / b;
+        case op_pow: return pow(a, b);
+        case op_min: return std::min(a, b);
+        case op_max: return std::max(a, b);
+        case op_atan2: return atan2(a, b);
+        case op_neg: return -a;
+        case op_sin: return sin(a);
+        case op_cos: return cos(a);
+        case op_tan: return tan(a);
+        case op_asin: return asin(a);
+        case op_acos: return acos(a);
+        case op_atan: return atan(a);
+        case op_sqrt: return sqrt(a);
+        case op_abs: return std::abs(a);
+        case op_exp: return exp(a);
+        case op_log: return log(a);
+        case op_floor: return floor(a);
+        default: return a;
+        }
+    }
+
+    //one instruction over n lanes, the plain loops are what the compiler vectorizes.
+    //Emit never gives an instruction a destination it also reads
+    static void Run(const Instruction& instruction, double* registers, int n)
+    {
+        double* __restrict d = registers + instruction.destination * batch_size;
+        const double* __restrict a = registers + instruction.a * batch_size;
+        const double* __restrict b = registers + instruction.b * batch_size;
+
+        switch (instruction.op)
+        {
+        case op_add: for (int i = 0; i < n; ++i) d[i] = a[i] + b[i]; break;
+        case op_sub: for (int i = 0; i < n; ++i) d[i] = a[i] - b[i]; break;
+        case op_mul: for (int i = 0; i < n; ++i) d[i] = a[i] * b[i]; break;
+        case op_div: for (int i = 0; i < n; ++i) d[i] = a[i] / b[i]; break;
+        case op_min: for (int i = 0; i < n; ++i) d[i] = a[i] < b[i] ? a[i] : b[i]; break;
+        case op_max: for (int i = 0; i < n; ++i) d[i] = a[i] > b[i] ? a[i] : b[i]; break;
+        case op_neg: for (int i = 0; i < n; ++i) d[i] = -a[i]; break;
+        case op_abs: for (int i = 0; i < n; ++i) d[i] = std::abs(a[i]); break;
+        case op_sqrt: for (int i = 0; i < n; ++i) d[i] = sqrt(a[i]); break;
+        case op_floor: for (int i = 0; i < n; ++i) d[i] = floor(a[i]); break;
+        case op_sin: for (int i = 0; i < n; ++i) d[i] = sin(a[i]); break;
+        case op_cos: for (int i = 0; i < n; ++i) d[i] = cos(a[i]); break;
+        case op_sincos:
+        {
+            double* __restrict c = registers + instruction.b * batch_size;
+            for (int i = 0; i < n; ++i)
+            {
+                //one load, so the pair becomes a single sincos call
+                auto x = a[i];
+                d[i] = sin(x);
+                c[i] = cos(x);
+            }
+            break;
+        }
+        default: for (int i = 0; i < n; ++i) d[i] = Apply(instruction.op, a[i], b[i]); break;
+        }
+    }
+
+    /* Parsing, straight into folded and deduplicated nodes */
+    struct Parser
+    {
+        std::string source;
+        size_t position = 0;
+        std::string error;
+
+        std::vector<Node> nodes;
+        //constants by their bits: NaN would break the ordering of the map and 0 and -0 must stay apart
+        std::map<std::tuple<int, int, int, uint64_t>, int> unique_nodes;
+        std::map<std::string, int> variables;
+
+        Parser(const std::string& source) : source(source)
+        {
+        }
+
+        int Add(Op op, int a = -1, int b = -1, double value = 0)
+        {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(bits));
+            auto key = std::make_tuple(int(op), a, b, bits);
+            auto found = unique_nodes.find(key);
+            if (found != unique_nodes.end())
+                return found->second;
+
+            nodes.push_back({ op, a, b, value });
+            unique_nodes[key] = int(nodes.size()) - 1;
+            return int(nodes.size()) - 1;
+        }
+
+        int Constant(double value)
+        {
+            return Add(op_constant, -1, -1, value);
+        }
+
+        bool IsConstant(int node, double value) const
+        {
+            return nodes[node].op == op_constant && nodes[node].value == value;
+        }
+
+        int UnaryNode(Op op, int a)
+        {
+            if (nodes[a].op == op_constant)
+                return Constant(Apply(op, nodes[a].value, 0));
+            return Add(op, a);
+        }
+
+        int BinaryNode(Op op, int a, int b)
+        {
+            if (nodes[a].op == op_constant && nodes[b].op == op_constant)
+                return Constant(Apply(op, nodes[a].value, nodes[b].value));
+
+            //identities that leave nothing to compute
+            if ((op == op_add && IsConstant(b, 0)) || (op == op_sub && IsConstant(b, 0)) ||
+                (op == op_mul && IsConstant(b, 1)) || (op == op_div && IsConstant(b, 1)) || (op == op_pow && IsConstant(b, 1)))
+                return a;
+            if ((op == op_add && IsConstant(a, 0)) || (op == op_mul && IsConstant(a, 1)))
+                return b;
+            if (op == op_pow && IsConstant(b, 2))
+                return Add(op_mul, a, a);
+
+            //commutative operands in a fixed order, so a*b and b*a merge
+            if ((op == op_add || op == op_mul || op == op_min || op == op_max) && a > b)
+                std::swap(a, b);
+            return Add(op, a, b);
+        }
+
+        bool Fail(const std::string& message)
+        {
+            if (error.empty())
+                error = message + " at character " + std::to_string(position + 1);
+            return false;
+        }
+
+        //skips blanks, but not the new lines that end statements
+        char Peek()
+        {
+            while (position < source.size() && (source[position] == ' ' || source[position] == '\t' || source[position] == '\r'))
+                ++position;
+            return position < source.size() ? source[position] : '\0';
+        }
+
+        bool Accept(char c)
+        {
+            if (Peek() != c)
+                return false;
+            ++position;
+            return true;
+        }
+
+        std::string Identifier()
+        {
+            Peek();
+            auto start = position;
+            while (position < source.size() && (isalnum(static_cast<unsigned char>(source[position])) || source[position] == '_'))
+                ++position;
+            return source.substr(start, position - start);
+        }
+
+        bool Program(int& x, int& y)
+        {
+            while (true)
+            {
+                while (Accept(';') || Accept('\n'))
+                    ;
+                if (Peek() == '\0')
+                    break;
+
+                if (!isalpha(static_cast<unsigned char>(Peek())))
+                    return Fail("Expected a variable name");
+                auto name = Identifier();
+                if (name == "t" || name == "pi")
+                    return Fail("Can't assign to " + name);
+                if (!Accept('='))
+                    return Fail("Expected '='");
+
+                int value;
+                if (!Expression(value))
+                    return false;
+                variables[name] = value;
+
+                if (Peek() != ';' && Peek() != '\n' && Peek() != '\0')
+                    return Fail("Expected the end of the statement");
+            }
+
+            if (variables.count("x") == 0 || variables.count("y") == 0)
+                return Fail("Both x and y have to be assigned");
+            x = variables["x"];
+            y = variables["y"];
+            return true;
+        }
+
+        bool Expression(int& result)
+        {
+            if (!Term(result))
+                return false;
+            while (true)
+            {
+                Op op;
+                if (Accept('+'))
+                    op = op_add;
+                else if (Accept('-'))
+                    op = op_sub;
+                else
+                    return true;
+
+                int right;
+                if (!Term(right))
+                    return false;
+                result = BinaryNode(op, result, right);
+            }
+        }
+
+        bool Term(int& result)
+        {
+            if (!Unary(result))
+                return false;
+            while (true)
+            {
+                Op op;
+                if (Accept('*'))
+                    op = op_mul;
+                else if (Accept('/'))
+                    op = op_div;
+                else
+                    return true;
+
+                int right;
+                if (!Unary(right))
+                    return false;
+                result = BinaryNode(op, result, right);
+            }
+        }
+
+        //-a^b is -(a^b), and a^b^c is a^(b^c)
+        bool Unary(int& result)
+        {
+            if (Accept('-'))
+            {
+                if (!Unary(result))
+                    return false;
+                result = UnaryNode(op_neg, result);
+                return true;
+            }
+
+            if (!Primary(result))
+                return false;
+            if (!Accept('^'))
+                return true;
+
+            int exponent;
+            if (!Unary(exponent))
+                return false;
+            result = BinaryNode(op_pow, result, exponent);
+            return true;
+        }
+
+        bool Primary(int& result)
+        {
+            auto c = Peek();
+            if (Accept('('))
+            {
+                if (!Expression(result))
+                    return false;
+                return Accept(')') || Fail("Expected ')'");
+            }
+
+            if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+            {
+                char* end;
+                auto value = strtod(source.c_str() + position, &end);
+                if (end == source.c_str() + position)
+                    return Fail("Bad number");
+                position = end - source.c_str();
+                result = Constant(value);
+                return true;
+            }
+
+            if (!isalpha(static_cast<unsigned char>(c)))
+                return Fail(c == '\0' ? "Unexpected end" : std::string("Unexpected '") + c + "'");
+
+            auto name = Identifier();
+            if (Peek() != '(')
+            {
+                if (name == "t")
+                    result = Add(op_t);
+                else if (name == "pi")
+                    result = Constant(glm::pi<double>());
+                else if (variables.count(name))
+                    result = variables[name];
+                else
+                    return Fail("Unknown variable " + name);
+                return true;
+            }
+
+            static const struct { const char* name; Op op; int arguments; } functions[] = {
+                { "sin", op_sin, 1 }, { "cos", op_cos, 1 }, { "tan", op_tan, 1 },
+                { "asin", op_asin, 1 }, { "acos", op_acos, 1 }, { "atan", op_atan, 1 },
+                { "sqrt", op_sqrt, 1 }, { "abs", op_abs, 1 }, { "exp", op_exp, 1 }, { "log", op_log, 1 }, { "floor", op_floor, 1 },
+                { "pow", op_pow, 2 }, { "min", op_min, 2 }, { "max", op_max, 2 }, { "atan2", op_atan2, 2 },
+            };
+            for (const auto& function : functions)
+            {
+                if (name != function.name)
+                    continue;
+
+                Accept('(');
+                int a, b = -1;
+                if (!Expression(a))
+                    return false;
+                if (function.arguments == 2 && !(Accept(',') && Expression(b)))
+                    return Fail("Expected a second argument");
+                if (!Accept(')'))
+                    return Fail("Expected ')'");
+
+                result = function.arguments == 1 ? UnaryNode(function.op, a) : BinaryNode(function.op, a, b);
+                return true;
+            }
+            return Fail("Unknown function " + name);
+        }
+    };
+
+    /* Code generation */
+    //registers for the nodes x and y depend on, each one is given back after the last instruction reading it
+    bool Emit(const std::vector<Node>& nodes, int x, int y, std::string& error)
+    {
+        std::vector<bool> needed(nodes.size());
+        needed[x] = needed[y] = true;
+        //children always come before their parents
+        for (int i = int(nodes.size()) - 1; i >= 0; --i)
+            if (needed[i])
+            {
+                if (nodes[i].a >= 0)
+                    needed[nodes[i].a] = true;
+                if (nodes[i].b >= 0)
+                    needed[nodes[i].b] = true;
+            }
+
+        //sines and cosines of the same argument are emitted together at the first of the two
+        std::vector<int> emitted_at(nodes.size());
+        for (int i = 0; i < int(nodes.size()); ++i)
+            emitted_at[i] = i;
+        for (int i = 0; i < int(nodes.size()); ++i)
+            if (needed[i] && emitted_at[i] == i && (nodes[i].op == op_sin || nodes[i].op == op_cos))
+                for (int j = i + 1; j < int(nodes.size()); ++j)
+                    if (needed[j] && nodes[j].op == (nodes[i].op == op_sin ? op_cos : op_sin) && nodes[j].a == nodes[i].a)
+                    {
+                        emitted_at[j] = i;
+                        break;
+                    }
+
+        //in emission order, a register is given back once the last instruction reading it is out
+        std::vector<int> last_use(nodes.size(), -1);
+        for (int i = 0; i < int(nodes.size()); ++i)
+            if (needed[i])
+            {
+                if (nodes[i].a >= 0)
+                    last_use[nodes[i].a] = std::max(last_use[nodes[i].a], emitted_at[i]);
+                if (nodes[i].b >= 0)
+                    last_use[nodes[i].b] = std::max(last_use[nodes[i].b], emitted_at[i]);
+            }
+        last_use[x] = last_use[y] = int(nodes.size());
+
+        code.clear();
+        constants.clear();
+        std::vector<int> node_register(nodes.size(), -1);
+        for (int i = 0; i < int(nodes.size()); ++i)
+        {
+            if (!needed[i])
+                continue;
+            if (nodes[i].op == op_t)
+                node_register[i] = 0;
+            if (nodes[i].op == op_constant)
+            {
+                constants.push_back(nodes[i].value);
+                node_register[i] = int(constants.size());
+            }
+        }
+
+        register_count = int(constants.size()) + 1;
+        std::vector<int> free_registers;
+        auto Allocate = [&]()
+        {
+            if (free_registers.empty())
+                return register_count++;
+            auto r = free_registers.back();
+            free_registers.pop_back();
+            return r;
+        };
+        auto Release = [&](int operand, int i)
+        {
+            if (operand >= 0 && last_use[operand] == i && nodes[operand].op != op_constant && nodes[operand].op != op_t &&
+                std::find(free_registers.begin(), free_registers.end(), node_register[operand]) == free_registers.end())
+                free_registers.push_back(node_register[operand]);
+        };
+
+        for (int i = 0; i < int(nodes.size()); ++i)
+        {
+            if (!needed[i] || node_register[i] != -1)
+                continue;
+
+            const auto& node = nodes[i];
+            node_register[i] = Allocate();
+            Instruction instruction = { node.op, uint8_t(node_register[i]), uint8_t(node_register[node.a]),
+                                        uint8_t(node.b >= 0 ? node_register[node.b] : 0) };
+
+            for (int j = i + 1; j < int(nodes.size()); ++j)
+                if (needed[j] && emitted_at[j] == i)
+                {
+                    node_register[j] = Allocate();
+                    auto sine = node.op == op_sin ? i : j;
+                    auto cosine = node.op == op_sin ? j : i;
+                    instruction = { op_sincos, uint8_t(node_register[sine]), uint8_t(node_register[node.a]), uint8_t(node_register[cosine]) };
+                    break;
+                }
+            code.push_back(instruction);
+
+            Release(node.a, i);
+            Release(node.b, i);
+        }
+
+        if (register_count > max_registers)
+        {
+            error = "The expressions need more than " + std::to_string(max_registers) + " registers";
+            return false;
+        }
+
+        x_register = node_register[x];
+        y_register = node_register[y];
+        return true;
+    }
+};
+
+/* Generators for a tabulated profile, like the ones in parametric_shape.h but the curve is evaluated once per
+   vertical segment instead of once per vertex. profile has one sample past each end, see ExpressionCurve::Profile */
+inline void GenerateProfilePositions(glm::vec3* positions, const std::vector<glm::dvec2>& profile, int rotation_segments, int r_begin, int r_end)
+{
+    auto vertical_segments = int(profile.size()) - 2;
+
+    positions += size_t(r_begin) * vertical_segments;
+    for (int r = r_begin; r < r_end; ++r)
+    {
+        auto angle = r / double(rotation_segments) * glm::two_pi<double>();
+        for (int v = 1; v <= vertical_segments; ++v)
+            *positions++ = glm::rotateY(glm::dvec3(profile[v], 0), angle);
+    }
+}
+
+inline void GenerateProfileNormals(glm::vec3* normals, const std::vector<glm::dvec2>& profile, int rotation_segments, int r_begin, int r_end)
+{
+    auto vertical_segments = int(profile.size()) - 2;
+    auto epsilon = glm::two_pi<double>() / rotation_segments;
+
+    normals += size_t(r_begin) * vertical_segments;
+    for (int r = r_begin; r < r_end; ++r)
+    {
+        auto angle = r / double(rotation_segments) * glm::two_pi<double>();
+        for (int v = 1; v <= vertical_segments; ++v)
+        {
+            auto p = glm::dvec3(profile[v], 0);
+            auto tangent_v = (glm::rotateY(glm::dvec3(profile[v + 1], 0), angle) - glm::rotateY(glm::dvec3(profile[v - 1], 0), angle)) / 2.;
+            auto tangent_r = (glm::rotateY(p, angle + epsilon) - glm::rotateY(p, angle - epsilon)) / 2.;
+            *normals++ = glm::normalize(glm::cross(tangent_r, tangent_v));
+        }
+    }
+}
@@ -1,17 +1,586 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
 #include "GLM/glm.hpp"
 #include "GLM/gtc/constants.hpp"
 #include "GLM/gtx/rotate_vector.hpp"
 #include "GLM/gtc/type_ptr.hpp"
 #include "glad.h"
 #include "GLFW/glfw3.h"
+#include "parametric_shape.h"
+#include "picking.h"
+#include "curve_expression.h"
+#include "baked_shapes.h"
+
+/* Memory Accounting */
+//live and peak bytes per mesh and category, on the CPU for vectors allocated through TrackedAllocator and on the
+//GPU for the storage committed through BufferData and RenderbufferStorage below
+struct MemoryTracker
+{
+    enum Side { cpu, gpu, side_count };
+    enum Storage { buffer_storage, renderbuffer_storage, program_storage };
+
+    struct Tag
+    {
+        std::string mesh;
+        std::string category;
+        std::atomic<long long> live[side_count] = {};
+        std::atomic<long long> peak[side_count] = {};
+        //sums over every tag, for the peak of the total
+        Tag* total = NULL;
+
+        void Add(Side side, long long bytes)
+        {
+            auto live_bytes = live[side] += bytes;
+            auto peak_bytes = peak[side].load();
+            while (live_bytes > peak_bytes && !peak[side].compare_exchange_weak(peak_bytes, live_bytes));
+
+            if (total != NULL)
+                total->Add(side, bytes);
+        }
+    };
+
+    std::mutex mutex;
+    //a std::map never moves its tags, allocators keep pointers to them
+    std::map<std::pair<std::string, std::string>, Tag> tags;
+    Tag all;
+    //what the storage of each GL object was committed for, replaced when it is committed again
+    std::map<std::pair<Storage, GLuint>, std::pair<Tag*, long long>> gpu_storage;
+
+    //GPU bytes a single mesh may commit, 0 for no limit, see FitBudget
+    long long mesh_budget = 0;
+
+    Tag* Find(const std::string& mesh, const std::string& category)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& tag = tags[std::make_pair(mesh, category)];
+        if (tag.total == NULL)
+        {
+            tag.mesh = mesh;
+            tag.category = category;
+            tag.total = &all;
+        }
+        return &tag;
+    }
+
+    void Committed(Storage storage, GLuint name, Tag* tag, long long bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& committed = gpu_storage[std::make_pair(storage, name)];
+        if (committed.first != NULL)
+            committed.first->Add(gpu, -committed.second);
+        committed = std::make_pair(tag, bytes);
+        tag->Add(gpu, bytes);
+    }
+
+    void Released(Storage storage, GLuint name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto committed = gpu_storage.find(std::make_pair(storage, name));
+        if (committed == gpu_storage.end())
+            return;
+        committed->second.first->Add(gpu, -committed->second.second);
+        gpu_storage.erase(committed);
+    }
+
+    //glBufferData on the buffer bound to target
+    void BufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void* data, GLenum usage, const std::string& mesh, const char* category)
+    {
+        glBufferData(target, size, data, usage);
+        Committed(buffer_storage, buffer, Find(mesh, category), size);
+    }
+
+    //glRenderbufferStorage on the bound renderbuffer
+    void RenderbufferStorage(GLuint renderbuffer, GLenum format, int bytes_per_pixel, glm::ivec2 size, const std::string& mesh, const char* category)
+    {
+        glRenderbufferStorage(GL_RENDERBUFFER, format, size.x, size.y);
+        Committed(renderbuffer_storage, renderbuffer, Find(mesh, category), (long long)(size.x) * size.y * bytes_per_pixel);
+    }
+
+    //halves both resolutions while the mesh would commit more than the budget on the GPU
+    void FitBudget(const std::string& mesh, int& vertical_segments, int& rotation_segments, const std::function<long long(int, int)>& gpu_bytes)
+    {
+        if (mesh_budget <= 0 || gpu_bytes(vertical_segments, rotation_segments) <= mesh_budget)
+            return;
+
+        std::cout << "Memory: " << mesh << " " << vertical_segments << "x" << rotation_segments << " needs "
+                  << Megabytes(gpu_bytes(vertical_segments, rotation_segments)) << " on the GPU, over the "
+                  << Megabytes(mesh_budget) << " budget";
+        while (gpu_bytes(vertical_segments, rotation_segments) > mesh_budget && vertical_segments > 2 && rotation_segments > 3)
+        {
+            vertical_segments = std::max(2, vertical_segments / 2);
+            rotation_segments = std::max(3, rotation_segments / 2);
+        }
+        std::cout << ", falling back to " << vertical_segments << "x" << rotation_segments << std::endl;
+    }
+
+    static std::string Megabytes(long long bytes)
+    {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(2);
+        if (std::abs(bytes) < 1024 * 1024)
+            text << bytes / 1024. << " KB";
+        else
+            text << bytes / (1024. * 1024.) << " MB";
+        return text.str();
+    }
+
+    //every tag, then the totals per category and overall, live / peak
+    void Report(const std::string& label)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::ostringstream report;
+        report << "Memory, " << label << ", live / peak:" << std::endl;
+        auto Line = [&report](const std::string& mesh, const std::string& category, const long long* live, const long long* peak)
+        {
+            report << "  " << std::left << std::setw(36) << mesh << std::setw(16) << category << std::right
+                   << " CPU " << std::setw(10) << Megabytes(live[cpu]) << " / " << std::setw(10) << Megabytes(peak[cpu])
+                   << "  GPU " << std::setw(10) << Megabytes(live[gpu]) << " / " << std::setw(10) << Megabytes(peak[gpu]) << std::endl;
+        };
+
+        std::map<std::string, std::pair<std::vector<long long>, std::vector<long long>>> categories;
+        for (const auto& entry : tags)
+        {
+            const auto& tag = entry.second;
+            long long live[side_count] = { tag.live[cpu].load(), tag.live[gpu].load() };
+            long long peak[side_count] = { tag.peak[cpu].load(), tag.peak[gpu].load() };
+            Line(tag.mesh, tag.category, live, peak);
+
+            auto& sums = categories[tag.category];
+            sums.first.resize(side_count);
+            sums.second.resize(side_count);
+            for (int side = 0; side < side_count; ++side)
+            {
+                sums.first[side] += live[side];
+                //a sum of peaks, they need not have happened at the same time
+                sums.second[side] += peak[side];
+            }
+        }
+        for (const auto& category : categories)
+            Line("all", category.first, category.second.first.data(), category.second.second.data());
+
+        long long live[side_count] = { all.live[cpu].load(), all.live[gpu].load() };
+        long long peak[side_count] = { all.peak[cpu].load(), all.peak[gpu].load() };
+        Line("total", "", live, peak);
+        std::cout << report.str();
+    }
+};
+
+//std::vector storage counted under a MemoryTracker tag
+template<typename T>
+struct TrackedAllocator
+{
+    typedef T value_type;
+
+    MemoryTracker::Tag* tag;
+
+    TrackedAllocator(MemoryTracker::Tag* tag)
+        : tag(tag)
+    {
+    }
+
+    template<typename U>
+    TrackedAllocator(const TrackedAllocator<U>& other)
+        : tag(other.tag)
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        tag->Add(MemoryTracker::cpu, (long long)(count * sizeof(T)));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* p, size_t count)
+    {
+        tag->Add(MemoryTracker::cpu, -(long long)(count * sizeof(T)));
+        std::allocator<T>().deallocate(p, count);
+    }
+
+    template<typename U>
+    bool operator==(const TrackedAllocator<U>& other) const
+    {
+        return tag == other.tag;
+    }
+
+    template<typename U>
+    bool operator!=(const TrackedAllocator<U>& other) const
+    {
+        return tag != other.tag;
+    }
+};
+
+template<typename T>
+using TrackedVector = std::vector<T, TrackedAllocator<T>>;
+
+/* Input Recording */
+//--record <file> logs cursor, key and resize events with the frame they arrived for, --replay <file> feeds them
+//back through the callbacks before the same frames. Both run the scenes on a virtual clock of frame * frame_seconds
+//instead of glfwGetTime, so a replay builds the same frame packets as the recorded session. The command line is not
+//part of the file, replay with the same options
+struct InputSession
+{
+    enum Mode { live, recording, replaying };
+    enum EventType : uint8_t { cursor_event, key_event, resize_event, end_event };
+
+    //little endian, a header of "INPT", version, frame_seconds, width and height, then per event the frame (u32),
+    //the offset (f32) and the type (u8) followed by x, y (f64) for the cursor, key (i16), action and mods (u8) for
+    //keys and width, height (u16) for resizes. The end event carries the number of frames
+    struct Event
+    {
+        uint32_t frame = 0;
+        //seconds after the previous packet was built, for reference only, the replay goes by frame
+        float offset = 0;
+        uint8_t type = end_event;
+        double x = 0, y = 0;
+        int key = 0, action = 0, mods = 0;
+        int width = 0, height = 0;
+    };
+
+    Mode mode = live;
+    double frame_seconds = 1 / 60.;
+    //the frame the next packet is built for, counted from the first frame after startup so the number of
+    //startup frames, which depends on how fast the meshes build, does not shift the events
+    uint32_t frame = 0;
+    double frame_start = 0;
+    std::string path;
+
+    std::ofstream file;
+    size_t recorded = 0;
+
+    std::vector<Event> events;
+    size_t next_event = 0;
+    uint32_t frame_count = 0;
+    //set while the replay drives the callbacks, live input is dropped otherwise
+    bool feeding = false;
+    //until Start, live input is dropped while recording too. Startup frames all run at time 0 and how many there are
+    //depends on how fast the meshes build, so input applied during them could not be replayed at the same frames
+    bool started = false;
+
+    template<typename T>
+    void Write(T value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    static bool Read(std::ifstream& in, T& value)
+    {
+        return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    bool Record(const std::string& record_path, glm::ivec2 screen_dimensions)
+    {
+        file.open(record_path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Error: Could not open " << record_path << " for recording" << std::endl;
+            return false;
+        }
+        path = record_path;
+        mode = recording;
+
+        file.write("INPT", 4);
+        Write<uint32_t>(1);
+        Write<double>(frame_seconds);
+        Write<int32_t>(screen_dimensions.x);
+        Write<int32_t>(screen_dimensions.y);
+        return true;
+    }
+
+    //reads the whole file up front and sets the window size it was recorded at
+    bool Replay(const std::string& replay_path, glm::ivec2& screen_dimensions)
+    {
+        std::ifstream in(replay_path, std::ios::binary);
+        char magic[4] = {};
+        uint32_t version = 0;
+        int32_t width = 0, height = 0;
+        if (!in.read(magic, 4) || std::memcmp(magic, "INPT", 4) != 0 || !Read(in, version) || version != 1 ||
+            !Read(in, frame_seconds) || !Read(in, width) || !Read(in, height) || frame_seconds <= 0)
+        {
+            std::cout << "Error: " << replay_path << " is not an input recording" << std::endl;
+            return false;
+        }
+
+        for (Event event; Read(in, event.frame) && Read(in, event.offset) && Read(in, event.type); event = Event())
+        {
+            bool complete = true;
+            if (event.type == cursor_event)
+                complete = Read(in, event.x) && Read(in, event.y);
+            else if (event.type == key_event)
+            {
+                int16_t key = 0;
+                uint8_t action = 0, mods = 0;
+                complete = Read(in, key) && Read(in, action) && Read(in, mods);
+                event.key = key;
+                event.action = action;
+                event.mods = mods;
+            }
+            else if (event.type == resize_event)
+            {
+                uint16_t event_width = 0, event_height = 0;
+                complete = Read(in, event_width) && Read(in, event_height);
+                event.width = event_width;
+                event.height = event_height;
+            }
+            else if (event.type == end_event)
+            {
+                frame_count = event.frame;
+                break;
+            }
+            else
+                complete = false;
+
+            if (!complete || (!events.empty() && event.frame < events.back().frame))
+            {
+                std::cout << "Error: " << replay_path << " is corrupt after " << events.size() << " events" << std::endl;
+                return false;
+            }
+            events.push_back(event);
+        }
+
+        //a recording that was cut short ends with its last event
+        if (frame_count == 0 && !events.empty())
+        {
+            frame_count = events.back().frame + 1;
+            std::cout << replay_path << " has no end, replaying " << frame_count << " frames" << std::endl;
+        }
+
+        path = replay_path;
+        mode = replaying;
+        screen_dimensions = glm::ivec2(width, height);
+        return true;
+    }
+
+    double Time() const
+    {
+        return mode == live ? glfwGetTime() : frame * frame_seconds;
+    }
+
+    //called by the callbacks with the event filled in, false for live input during a replay or before Start.
+    //ESC still gets through, to end a replay or the startup early
+    bool Accept(Event event)
+    {
+        if (mode == live)
+            return true;
+        bool escape = event.type == key_event && event.key == GLFW_KEY_ESCAPE;
+        if (mode == replaying)
+            return feeding || escape;
+        if (!started)
+            return escape;
+
+        event.frame = frame;
+        event.offset = float(glfwGetTime() - frame_start);
+        Write(event.frame);
+        Write(event.offset);
+        Write(event.type);
+        if (event.type == cursor_event)
+        {
+            Write(event.x);
+            Write(event.y);
+        }
+        else if (event.type == key_event)
+        {
+            Write<int16_t>(int16_t(event.key));
+            Write<uint8_t>(uint8_t(event.action));
+            Write<uint8_t>(uint8_t(event.mods));
+        }
+        else if (event.type == resize_event)
+        {
+            Write<uint16_t>(uint16_t(std::min(event.width, 0xffff)));
+            Write<uint16_t>(uint16_t(std::min(event.height, 0xffff)));
+        }
+        ++recorded;
+        return true;
+    }
+
+    //the recorded events of the frame about to be built, in order
+    const Event* Next()
+    {
+        if (mode != replaying || next_event == events.size() || events[next_event].frame > frame)
+            return NULL;
+        return &events[next_event++];
+    }
+
+    //once startup is over, frame 0 is built next
+    void Start()
+    {
+        started = true;
+        frame_start = glfwGetTime();
+    }
+
+    //after the packet of a frame past startup is built, the virtual clock only runs while recording or replaying
+    void Advance()
+    {
+        if (mode == live)
+            return;
+        ++frame;
+        frame_start = glfwGetTime();
+    }
+
+    bool Finished() const
+    {
+        return mode == replaying && frame >= frame_count;
+    }
+
+    void Stop()
+    {
+        if (mode == recording)
+        {
+            Write<uint32_t>(frame);
+            Write<float>(0);
+            Write<uint8_t>(end_event);
+            file.close();
+            std::cout << "Recorded " << recorded << " input events over " << frame << " frames to " << path << std::endl;
+        }
+        else if (mode == replaying)
+            std::cout << "Replayed " << next_event << " of " << events.size() << " input events over " << std::min(frame, frame_count)
+                      << " of " << frame_count << " frames from " << path << std::endl;
+        mode = live;
+    }
+};
+
+//per column means of two --frame-log files matched by frame, and the frames that slowed down the most. The logs of
+//two builds replaying the same recording line up frame for frame
+static void CompareFrameLogs(const std::string& path, const std::string& baseline_path)
+{
+    auto Load = [](const std::string& log_path, std::vector<std::string>& columns, std::map<long, std::vector<double>>& rows)
+    {
+        std::ifstream in(log_path);
+        std::string line;
+        if (!std::getline(in, line))
+            return false;
+
+        std::istringstream header(line);
+        std::string column;
+        while (std::getline(header, column, ','))
+            columns.push_back(column);
+
+        while (std::getline(in, line))
+        {
+            std::istringstream row(line);
+            std::string cell;
+            std::vector<double> values;
+            while (std::getline(row, cell, ','))
+                values.push_back(std::atof(cell.c_str()));
+            if (values.size() == columns.size())
+                rows[long(values[0])] = values;
+        }
+        return true;
+    };
+
+    std::vector<std::string> columns, baseline_columns;
+    std::map<long, std::vector<double>> rows, baseline_rows;
+    if (!Load(path, columns, rows) || !Load(baseline_path, baseline_columns, baseline_rows) || columns != baseline_columns)
+    {
+        std::cout << "Error: Could not compare " << path << " with " << baseline_path << std::endl;
+        return;
+    }
+
+    //the columns after frame and time are milliseconds
+    const size_t first_timing = 2;
+    std::vector<double> sums(columns.size()), baseline_sums(columns.size());
+    std::vector<std::pair<double, long>> total_deltas;
+    for (const auto& row : rows)
+    {
+        auto baseline_row = baseline_rows.find(row.first);
+        if (baseline_row == baseline_rows.end())
+            continue;
+
+        double total = 0, baseline_total = 0;
+        for (size_t i = first_timing; i < columns.size(); ++i)
+        {
+            sums[i] += row.second[i];
+            baseline_sums[i] += baseline_row->second[i];
+            total += row.second[i];
+            baseline_total += baseline_row->second[i];
+        }
+        total_deltas.push_back({ total - baseline_total, row.first });
+    }
+
+    if (total_deltas.empty())
+    {
+        std::cout << "Error: " << path << " and " << baseline_path << " have no frames in common" << std::endl;
+        return;
+    }
+
+    auto frames = double(total_deltas.size());
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3) << "Frame log against " << baseline_path << ", " << total_deltas.size() << " frames |";
+    for (size_t i = first_timing; i < columns.size(); ++i)
+    {
+        auto mean = sums[i] / frames;
+        auto baseline_mean = baseline_sums[i] / frames;
+        report << " " << columns[i] << " " << baseline_mean << " -> " << mean;
+        if (baseline_mean > 0)
+            report << " (" << std::showpos << (mean / baseline_mean - 1) * 100 << std::noshowpos << "%)";
+    }
+    std::cout << report.str() << std::endl;
+
+    std::sort(total_deltas.rbegin(), total_deltas.rend());
+    std::ostringstream worst;
+    worst << std::fixed << std::setprecision(3) << "Frames that slowed down the most:";
+    for (size_t i = 0; i < std::min<size_t>(5, total_deltas.size()); ++i)
+        worst << " " << total_deltas[i].second << " " << std::showpos << total_deltas[i].first << std::noshowpos << " ms";
+    std::cout << worst.str() << std::endl;
+}
 
 /* Keep the global state inside this struct */
 static struct {
     glm::dvec2 mouse_position;
     glm::ivec2 screen_dimensions = glm::ivec2(600, 600);
     int scene=0;
+    bool adaptive_mesh = false;
+    bool render_thread = false;
+    bool capture = false;
+    std::string capture_path = "capture";
+    //--curve "<expression>" replaces the profile of the scene 6 uniform mesh, see curve_expression.h
+    std::string curve_source;
+    bool gl_state_report = false;
+    bool picking = false;
+    bool parallel_shader_compile = false;
+    //D, renders at the scale that keeps the GPU time of the frame within the budget, see DynamicResolution
+    bool dynamic_resolution = false;
+    double frame_budget_ms = 1000 / 60.;
+    std::string resolution_log_path = "dynamic_resolution.csv";
+    //L, scenes 0 and 1 draw GL_LINES over each edge once instead of the triangles in GL_LINE polygon mode
+    bool unique_edges = true;
+    //--wireframe-resolution <n> makes the 60x20 spiky circle n x n, to compare the two on a large grid
+    int wireframe_resolution = 0;
+    //--mesh-budget <MB> sets memory.mesh_budget, M prints the report
+    MemoryTracker memory;
+    //whether the program binaries can be counted, see ProgramBinaryLengthSupported
+    bool program_binary_length = false;
+    //--record <file> / --replay <file>, see InputSession
+    InputSession input;
+    //--frame-log <file.csv> writes the phase times of every frame, --frame-log-baseline <file.csv> compares on exit
+    std::string frame_log_path;
+    std::string frame_log_baseline_path;
 } Globals;
 
 /* GLFW Callback functions */
@@ -22,6 +591,13 @@ static void ErrorCallback(int error, const char* description)
 
 static void CursorPositionCallback(GLFWwindow* window, double x, double y)
 {
+    InputSession::Event event;
+    event.type = InputSession::cursor_event;
+    event.x = x;
+    event.y = y;
+    if (!Globals.input.Accept(event))
+        return;
+
     Globals.mouse_position.x = x;
     Globals.mouse_position.y = y;
 }
@@ -29,15 +605,27 @@ static void CursorPositionCallback(GLFWwindow* window, double x, double y)
 
 static void WindowSizeCallback(GLFWwindow* window, int width, int height)
 {
+    InputSession::Event event;
+    event.type = InputSession::resize_event;
+    event.width = width;
+    event.height = height;
+    if (!Globals.input.Accept(event))
+        return;
+
     Globals.screen_dimensions.x = width;
     Globals.screen_dimensions.y = height;
 
-    glViewport(0, 0, width, height);
+    //the viewport follows with the next frame packet, on the thread that owns the context
 }
 
 /* OpenGL Utility Structs */
+struct MeshBuilder;
+
 struct VAO
 {
+    //for the memory report and the picking output
+    std::string name;
+
     GLuint id;
 
     GLuint position_buffer;
@@ -47,27 +635,58 @@ struct VAO
     GLuint element_array_buffer;
     GLsizei element_array_count;
 
+    //GL_LINES over the unique edges, a second vertex array on the same vertex buffers, see CreateEdges
+    GLuint edge_id = 0;
+    GLuint edge_array_buffer = 0;
+    GLsizei edge_array_count = 0;
+
     VAO(
+        const std::string& name,
         const std::vector<glm::vec3>& positions,
         const std::vector<glm::vec3>& normals,
         const std::vector<GLuint>& indices
     )
+        : name(name)
+    {
+        vertex_count = GLsizei(positions.size());
+        element_array_count = GLsizei(indices.size());
+        Create(positions.data(), normals.data(), indices.data());
+    }
+
+    //geometry baked at compile time, see baked_shapes.h. The read only arrays go to glBufferData as they are
+    template<int vertical_segments, int rotation_segments>
+    VAO(const std::string& name, const BakedShape<vertical_segments, rotation_segments>& shape)
+        : name(name)
+    {
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "BakedShape stores tightly packed vec3s");
+        vertex_count = shape.vertex_count;
+        element_array_count = shape.element_array_count;
+        Create(shape.positions, shape.normals, shape.indices);
+
+        //picking reads the mesh back through generate
+        rows = rotation_segments;
+        generate = [&shape](glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)
+        {
+            shape.CopyRows(positions, normals, indices, r_begin, r_end);
+        };
+    }
+
+    //vertex_count vec3s of positions and normals, element_array_count indices
+    void Create(const void* positions, const void* normals, const GLuint* indices)
     {
         glGenVertexArrays(1, &id);
         glBindVertexArray(id);
 
         glGenBuffers(1, &position_buffer);
         glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
-        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        Globals.memory.BufferData(GL_ARRAY_BUFFER, position_buffer, vertex_count * sizeof(glm::vec3), positions, GL_STATIC_DRAW, name, "positions");
 
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
         glEnableVertexAttribArray(0);
 
-        vertex_count = GLsizei(positions.size());
-
         glGenBuffers(1, &normals_buffer);
         glBindBuffer(GL_ARRAY_BUFFER, normals_buffer);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
+        Globals.memory.BufferData(GL_ARRAY_BUFFER, normals_buffer, vertex_count * sizeof(glm::vec3), normals, GL_STATIC_DRAW, name, "normals");
 
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
         glEnableVertexAttribArray(1);
@@ -75,132 +694,1810 @@ struct VAO
 
         glGenBuffers(1, &element_array_buffer);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_array_buffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-
-        element_array_count = GLsizei(indices.size());
+        Globals.memory.BufferData(GL_ELEMENT_ARRAY_BUFFER, element_array_buffer, element_array_count * sizeof(GLuint), indices, GL_STATIC_DRAW, name, "indices");
     }
-};
-
-/* OpenGL Utility Functions */
-GLuint CreateShaderFromSource(const GLenum& shader_type, const GLchar * source)
-{
-    GLuint shader = glCreateShader(shader_type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
 
-    int success;
-    char info_log[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    //for wireframes, the grid has to be the one the triangles came from
+    void CreateEdges(int vertical_segments, int rotation_segments)
     {
-        std::cout << "Error: Shader Compilation failed" << std::endl;
-        glGetShaderInfoLog(shader, 512, NULL, info_log);
-        std::cout << info_log << std::endl;
-
-        glDeleteShader(shader);
-        return NULL;
-    }
+        TrackedVector<GLuint> edges(size_t(rotation_segments) * (3 * vertical_segments - 2) * 2, TrackedAllocator<GLuint>(Globals.memory.Find(name, "edges")));
+        GenerateGridEdges(edges.data(), vertical_segments, rotation_segments, 0, rotation_segments);
 
-    return shader;
-}
+        glGenVertexArrays(1, &edge_id);
+        glBindVertexArray(edge_id);
 
-GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source)
-{
-    GLuint program = glCreateProgram();
+        glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
+        glEnableVertexAttribArray(0);
 
-    GLuint vertex_shader = CreateShaderFromSource(GL_VERTEX_SHADER, vertex_shader_source);
-    GLuint fragment_shader = CreateShaderFromSource(GL_FRAGMENT_SHADER, fragment_shader_source);
+        glBindBuffer(GL_ARRAY_BUFFER, normals_buffer);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
+        glEnableVertexAttribArray(1);
 
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
+        glGenBuffers(1, &edge_array_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, edge_array_buffer);
+        Globals.memory.BufferData(GL_ELEMENT_ARRAY_BUFFER, edge_array_buffer, edges.size() * sizeof(GLuint), edges.data(), GL_STATIC_DRAW, name, "edges");
+        edge_array_count = GLsizei(edges.size());
+    }
 
-    int success;
-    char info_log[512];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success)
+    //writes rows [r_begin, r_end) of the positions, normals and indices of a parametric grid
+    typedef std::function<void(glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)> RowGenerator;
+
+    //true once the buffers hold the whole mesh, see FinishBuild
+    bool ready = true;
+    int build_ticket = -1;
+    int rows = 0;
+    RowGenerator generate;
+    glm::vec3* mapped_positions = NULL;
+    glm::vec3* mapped_normals = NULL;
+    GLuint* mapped_indices = NULL;
+
+    //generates the parametric shape straight into the mapped buffers, no copy of it stays on the CPU heap.
+    //with a builder the buffers stay mapped and are filled on its thread, call FinishBuild once it is done
+    VAO(const std::string& name, glm::dvec2(*parametric_line)(double), int vertical_segments, int rotation_segments, MeshBuilder* builder = NULL)
+        : VAO(name, vertical_segments * rotation_segments, rotation_segments * (vertical_segments - 1) * 6, rotation_segments,
+              [=](glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)
+              {
+                  GenerateParametricPositions(positions, parametric_line, vertical_segments, rotation_segments, r_begin, r_end);
+                  GenerateParametricNormals(normals, parametric_line, vertical_segments, rotation_segments, r_begin, r_end);
+                  GenerateGridIndices(indices, vertical_segments, rotation_segments, r_begin, r_end);
+              }, builder)
     {
-        std::cout << "Error: Program Linking failed" << std::endl;
-        glGetProgramInfoLog(program, 512, NULL, info_log);
-        std::cout << info_log << std::endl;
+    }
 
-        glDeleteProgram(program);
-        return NULL;
+    //same as above for a non-uniform set of profile samples, see AdaptiveProfileSamples
+    VAO(const std::string& name, glm::dvec2(*parametric_line)(double), const std::vector<double>& profile_samples, int rotation_segments, MeshBuilder* builder = NULL)
+        : VAO(name, int(profile_samples.size()) * rotation_segments, rotation_segments * (int(profile_samples.size()) - 1) * 6, rotation_segments,
+              [=](glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)
+              {
+                  GenerateSampledPositions(positions, parametric_line, profile_samples, rotation_segments, r_begin, r_end);
+                  GenerateSampledNormals(normals, parametric_line, profile_samples, rotation_segments, r_begin, r_end);
+                  GenerateGridIndices(indices, int(profile_samples.size()), rotation_segments, r_begin, r_end);
+              }, builder)
+    {
     }
 
-    return program;
-}
+    VAO(const std::string& name, int vertices, int elements, int rows, RowGenerator generate, MeshBuilder* builder);
 
-/* Fun Stuff */
-void GenerateParametricShape(
-    std::vector<glm::vec3>& positions,
-    std::vector<glm::vec3>& normals,
-    std::vector<GLuint>& indices,
-    glm::dvec2(*parametric_line)(double),
-    int vertical_segments,
-    int rotation_segments
-)
-{
-    auto parametric_surface = [parametric_line](double t, double r)
+    //unmaps the buffers of a background build, regenerating them here if their storage got corrupted meanwhile
+    void FinishBuild()
     {
-        auto p = glm::dvec3(parametric_line(t), 0);
-
-        //auto s = sin(r * glm::two_pi<double>() * 6) / 2 + 1;
-        //qp *= s * 0.3; //makes bigger
-        //p.y *= sin(r * glm::two_pi<double>() * 3) / 2 + 1;
-        return glm::rotateY(p, r * glm::two_pi<double>());
-    };
+        bool intact = mapped_positions != NULL && mapped_normals != NULL && mapped_indices != NULL;
+        if (mapped_positions != NULL)
+            intact = Unmap(position_buffer) && intact;
+        if (mapped_normals != NULL)
+            intact = Unmap(normals_buffer) && intact;
+        if (mapped_indices != NULL)
+            intact = Unmap(element_array_buffer) && intact;
+        mapped_positions = NULL;
+        mapped_normals = NULL;
+        mapped_indices = NULL;
+
+        if (!intact)
+            Upload();
+        ready = true;
+    }
 
-    //vertices are calculated by this resolution
-    positions.reserve(vertical_segments * rotation_segments);
-    for (int r = 0; r < rotation_segments; ++r)
-        for (int v = 0; v < vertical_segments; ++v)
-            positions.push_back(parametric_surface(v / double(vertical_segments - 1), r / double(rotation_segments)));
+    template<typename T>
+    T* Map(GLuint buffer, size_t count, const char* category)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        Globals.memory.BufferData(GL_COPY_WRITE_BUFFER, buffer, count * sizeof(T), NULL, GL_STATIC_DRAW, name, category);
+        return static_cast<T *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, count * sizeof(T), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    }
 
-    normals.reserve(vertical_segments * rotation_segments);
-    for (int r = 0; r < rotation_segments; ++r)
-        for (int v = 0; v < vertical_segments; ++v)
-        {
-            auto nv = v / double(vertical_segments - 1);
-            auto nr = r / double(rotation_segments);
-            
-            auto epsilonv = 1 / double(vertical_segments - 1);
-            auto epsilonr = 1 / double(rotation_segments);
-            
-            auto to_next_v = parametric_surface(nv + epsilonv, nr) - parametric_surface(nv, nr);
-            auto from_prev_v = parametric_surface(nv, nr) - parametric_surface(nv - epsilonv, nr);
-            auto tangent_v = (to_next_v + from_prev_v) / 2.; //take average
+    bool Unmap(GLuint buffer)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        return glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+    }
 
-            auto to_next_r = parametric_surface(nv, nr + epsilonr) - parametric_surface(nv, nr);
-            auto from_prev_r = parametric_surface(nv, nr) - parametric_surface(nv, nr - epsilonr);
-            auto tangent_r = (to_next_r + from_prev_r) / 2.; //take average
-                      
-            auto normal = glm::normalize(glm::cross(tangent_r, tangent_v));
-            normals.push_back(normal);
-        }
+    //generates the whole mesh on the calling thread and uploads it through staging copies
+    void Upload()
+    {
+        TrackedVector<glm::vec3> positions(vertex_count, TrackedAllocator<glm::vec3>(Globals.memory.Find(name, "positions")));
+        TrackedVector<glm::vec3> normals(vertex_count, TrackedAllocator<glm::vec3>(Globals.memory.Find(name, "normals")));
+        TrackedVector<GLuint> indices(element_array_count, TrackedAllocator<GLuint>(Globals.memory.Find(name, "indices")));
+        generate(positions.data(), normals.data(), indices.data(), 0, rows);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, position_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, positions.size() * sizeof(glm::vec3), positions.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, normals_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, normals.size() * sizeof(glm::vec3), normals.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, element_array_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+    }
 
-    auto VRtoIndex = [vertical_segments, rotation_segments](int v, int r) //2D to 1D map
+    //allocates the buffer and lets generate write into its mapped storage
+    template<typename T, typename F>
+    static void FillBuffer(GLenum target, GLuint buffer, size_t count, const std::string& mesh, const char* category, F generate)
     {
-        return (r % rotation_segments) * vertical_segments + v;
-    };
-    indices.reserve(rotation_segments * (vertical_segments - 1) * 6);
-    for (int r = 0; r < rotation_segments; ++r)
-        for (int v = 0; v < vertical_segments-1; ++v)
+        glBindBuffer(target, buffer);
+        Globals.memory.BufferData(target, buffer, count * sizeof(T), NULL, GL_STATIC_DRAW, mesh, category);
+
+        auto mapped = static_cast<T *>(glMapBufferRange(target, 0, count * sizeof(T), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if (mapped != NULL)
         {
-            indices.push_back(VRtoIndex(v + 1, r));
-            indices.push_back(VRtoIndex(v, r + 1));
-            indices.push_back(VRtoIndex(v, r));
+            generate(mapped);
 
-            indices.push_back(VRtoIndex(v + 1, r));
-            indices.push_back(VRtoIndex(v + 1, r + 1));
-            indices.push_back(VRtoIndex(v, r + 1));
+            //false means the storage got corrupted while mapped, upload it again below
+            if (glUnmapBuffer(target) == GL_TRUE)
+                return;
         }
-}
 
-static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+        TrackedVector<T> staging(count, TrackedAllocator<T>(Globals.memory.Find(mesh, category)));
+        generate(staging.data());
+        glBufferSubData(target, 0, count * sizeof(T), staging.data());
+    }
+};
+
+//shadows the state the frame submission touches and drops calls that would not change it.
+//anything that binds behind its back has to call Invalidate
+struct GLState
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS){
-        glfwSetWindowShouldClose(window, GL_TRUE);
+    enum Call { use_program, polygon_mode, bind_vertex_array, depth_test, uniform, call_count };
+    const char* call_names[call_count] = { "glUseProgram", "glPolygonMode", "glBindVertexArray", "glEnable/glDisable", "glUniform" };
+
+    //calls that reached the driver and calls that were dropped, summed over frames until the next Report
+    long long issued[call_count] = {};
+    long long elided[call_count] = {};
+    int frames = 0;
+
+    GLuint current_program;
+    GLenum current_polygon_mode;
+    GLuint current_vertex_array;
+    int current_depth_test;
+    //last values uploaded to each (program, location)
+    std::map<std::pair<GLuint, GLint>, std::vector<float>> uniforms;
+
+    GLState()
+    {
+        Invalidate();
+    }
+
+    //forgets the bindings, uniform values stay with their programs
+    void Invalidate()
+    {
+        current_program = ~0u;
+        current_polygon_mode = 0;
+        current_vertex_array = ~0u;
+        current_depth_test = -1;
+    }
+
+    bool Issue(Call call, bool redundant)
+    {
+        ++(redundant ? elided : issued)[call];
+        return !redundant;
+    }
+
+    void UseProgram(GLuint program)
+    {
+        if (Issue(use_program, program == current_program))
+        {
+            glUseProgram(program);
+            current_program = program;
+        }
+    }
+
+    void PolygonMode(GLenum mode)
+    {
+        if (Issue(polygon_mode, mode == current_polygon_mode))
+        {
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+            current_polygon_mode = mode;
+        }
+    }
+
+    void BindVertexArray(GLuint vertex_array)
+    {
+        if (Issue(bind_vertex_array, vertex_array == current_vertex_array))
+        {
+            glBindVertexArray(vertex_array);
+            current_vertex_array = vertex_array;
+        }
+    }
+
+    void DepthTest(bool enabled)
+    {
+        if (Issue(depth_test, int(enabled) == current_depth_test))
+        {
+            if (enabled)
+                glEnable(GL_DEPTH_TEST);
+            else
+                glDisable(GL_DEPTH_TEST);
+            current_depth_test = int(enabled);
+        }
+    }
+
+    //the uniforms go to the current program, locations of -1 are ignored like GL does. After Invalidate the program
+    //is unknown, so the value is uploaded and not shadowed under a program it may not belong to
+    bool ShadowUniform(GLint location, const float* values, size_t count)
+    {
+        if (location == -1)
+            return false;
+        if (current_program == ~0u)
+            return Issue(uniform, false);
+
+        auto& shadow = uniforms[std::make_pair(current_program, location)];
+        bool redundant = shadow.size() == count && std::equal(values, values + count, shadow.begin());
+        if (!redundant)
+            shadow.assign(values, values + count);
+        return Issue(uniform, redundant);
+    }
+
+    void Uniform(GLint location, const glm::vec2& value)
+    {
+        if (ShadowUniform(location, glm::value_ptr(value), 2))
+            glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+
+    void Uniform(GLint location, const glm::vec3& value)
+    {
+        if (ShadowUniform(location, glm::value_ptr(value), 3))
+            glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+
+    void Uniform(GLint location, const glm::mat4& value)
+    {
+        if (ShadowUniform(location, glm::value_ptr(value), 16))
+            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Frame()
+    {
+        ++frames;
+    }
+
+    //prints the issued and elided calls per frame since the last report and starts counting anew
+    void Report(const std::string& label)
+    {
+        if (frames == 0)
+            return;
+
+        std::ostringstream report;
+        report << "GL state, " << label << ", per frame over " << frames << " frames:";
+        for (int call = 0; call < call_count; ++call)
+            report << " " << call_names[call] << " " << double(issued[call]) / frames << " issued "
+                   << double(elided[call]) / frames << " elided |";
+        std::cout << report.str() << std::endl;
+
+        std::fill(std::begin(issued), std::end(issued), 0);
+        std::fill(std::begin(elided), std::end(elided), 0);
+        frames = 0;
+    }
+};
+
+//GPU time between Begin and End, from timestamp queries so it can sit inside a GL_TIME_ELAPSED query.
+//results are read a few frames later without waiting, a frame with every pair still in flight goes untimed
+struct GpuTimer
+{
+    static const int query_count = 4;
+
+    GLuint queries[query_count][2];
+    bool pending[query_count] = {};
+    //pairs still in flight when the label changes are dropped
+    int generations[query_count] = {};
+    int generation = 0;
+    int next = 0;
+    bool timing = false;
+
+    std::string label;
+    double report_time = 0;
+    double seconds = 0;
+    int measurements = 0;
+    long long lines = 0;
+    int frames = 0;
+
+    GpuTimer()
+    {
+        glGenQueries(query_count * 2, &queries[0][0]);
+    }
+
+    void Begin()
+    {
+        Collect();
+        timing = !pending[next];
+        if (timing)
+        {
+            glQueryCounter(queries[next][0], GL_TIMESTAMP);
+            generations[next] = generation;
+        }
+    }
+
+    void End()
+    {
+        if (!timing)
+            return;
+        glQueryCounter(queries[next][1], GL_TIMESTAMP);
+        pending[next] = true;
+        next = (next + 1) % query_count;
+    }
+
+    void Collect()
+    {
+        for (int i = 0; i < query_count; ++i)
+        {
+            auto q = (next + i) % query_count;
+            if (!pending[q])
+                continue;
+
+            GLint available = 0;
+            glGetQueryObjectiv(queries[q][1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[q][0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[q][1], GL_QUERY_RESULT, &end);
+            pending[q] = false;
+            if (generations[q] != generation)
+                continue;
+            seconds += (end - begin) * 1e-9;
+            ++measurements;
+        }
+    }
+
+    //once per second, and whenever the label changes so the averages never mix two setups
+    void Report(double now, const std::string& frame_label, long long frame_lines)
+    {
+        if (frame_label != label || (report_time > 0 && now - report_time >= 1))
+        {
+            if (frames > 0 && measurements > 0)
+                std::cout << label << ": " << seconds * 1000 / measurements << " ms GPU/frame, "
+                          << lines / frames << " lines/frame, over " << frames << " frames" << std::endl;
+            if (frame_label != label)
+                ++generation;
+            label = frame_label;
+            report_time = now;
+            seconds = 0;
+            measurements = 0;
+            lines = 0;
+            frames = 0;
+        }
+        lines += frame_lines;
+        ++frames;
+    }
+};
+
+/* CPU Utility Structs */
+struct WorkerPool
+{
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    //ParallelFor may be called from more than one thread, one job runs at a time
+    std::mutex call_mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    const std::function<void(int, int)>* job = NULL;
+    int job_count = 0;
+    int job_generation = 0;
+    int pending = 0;
+    bool quit = false;
+
+    WorkerPool(unsigned thread_count = std::thread::hardware_concurrency())
+    {
+        //the calling thread always takes the first slice, so spawn one less
+        for (unsigned i = 1; i < thread_count; ++i)
+            threads.emplace_back([this, i]() { Run(int(i)); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        job_ready.notify_all();
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    int Size() const
+    {
+        return int(threads.size()) + 1;
+    }
+
+    //splits [0, count) into one contiguous range per thread and blocks until all of them are done
+    void ParallelFor(int count, const std::function<void(int, int)>& fn)
+    {
+        if (threads.empty() || count < 2)
+        {
+            fn(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> call_lock(call_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            job_count = count;
+            pending = int(threads.size());
+            ++job_generation;
+        }
+        job_ready.notify_all();
+
+        RunSlice(fn, 0, count);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [this]() { return pending == 0; });
+    }
+
+    void RunSlice(const std::function<void(int, int)>& fn, int slice, int count)
+    {
+        int begin = int(static_cast<long long>(count) * slice / Size());
+        int end = int(static_cast<long long>(count) * (slice + 1) / Size());
+        if (begin < end)
+            fn(begin, end);
+    }
+
+    void Run(int slice)
+    {
+        int seen_generation = 0;
+        while (true)
+        {
+            const std::function<void(int, int)>* fn;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [&]() { return quit || job_generation != seen_generation; });
+                if (quit)
+                    return;
+
+                seen_generation = job_generation;
+                fn = job;
+                count = job_count;
+            }
+
+            RunSlice(*fn, slice, count);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                job_done.notify_one();
+        }
+    }
+};
+
+//runs tasks in order on its own thread, each task can spread its work over the worker pool
+struct MeshBuilder
+{
+    WorkerPool& workers;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::vector<std::function<void(WorkerPool&)>> tasks;
+    size_t next_task = 0;
+    std::atomic<int> finished{0};
+    bool quit = false;
+
+    MeshBuilder(WorkerPool& workers) : workers(workers)
+    {
+        thread = std::thread([this]() { Run(); });
+    }
+
+    ~MeshBuilder()
+    {
+        Stop();
+    }
+
+    //returns the ticket to pass to Finished
+    int Enqueue(std::function<void(WorkerPool&)> task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(task);
+        task_ready.notify_one();
+        return int(tasks.size()) - 1;
+    }
+
+    //tasks finish in the order they were enqueued
+    bool Finished(int ticket) const
+    {
+        return finished.load() > ticket;
+    }
+
+    //waits for the running task and drops the rest, must happen before the context holding their mapped buffers goes away
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        task_ready.notify_one();
+
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void Run()
+    {
+        while (true)
+        {
+            std::function<void(WorkerPool&)> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_ready.wait(lock, [this]() { return quit || next_task < tasks.size(); });
+                if (quit)
+                    return;
+
+                task = tasks[next_task++];
+            }
+
+            task(workers);
+            ++finished;
+        }
+    }
+};
+
+//maps the buffers and fills them right away, or on the builder's thread when there is one
+VAO::VAO(const std::string& name, int vertices, int elements, int rows, RowGenerator generate, MeshBuilder* builder)
+    : name(name)
+{
+    vertex_count = GLsizei(vertices);
+    element_array_count = GLsizei(elements);
+    this->rows = rows;
+    this->generate = generate;
+
+    glGenVertexArrays(1, &id);
+    glBindVertexArray(id);
+
+    glGenBuffers(1, &position_buffer);
+    glGenBuffers(1, &normals_buffer);
+    glGenBuffers(1, &element_array_buffer);
+
+    mapped_positions = Map<glm::vec3>(position_buffer, vertex_count, "positions");
+    mapped_normals = Map<glm::vec3>(normals_buffer, vertex_count, "normals");
+    mapped_indices = Map<GLuint>(element_array_buffer, element_array_count, "indices");
+
+    glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, normals_buffer);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_array_buffer);
+
+    bool mapped = mapped_positions != NULL && mapped_normals != NULL && mapped_indices != NULL;
+    if (mapped && builder != NULL)
+    {
+        ready = false;
+        auto positions = mapped_positions;
+        auto normals = mapped_normals;
+        auto indices = mapped_indices;
+        build_ticket = builder->Enqueue([=](WorkerPool& workers)
+        {
+            workers.ParallelFor(rows, [&](int r_begin, int r_end) { generate(positions, normals, indices, r_begin, r_end); });
+        });
+        return;
+    }
+
+    if (mapped)
+        generate(mapped_positions, mapped_normals, mapped_indices, 0, rows);
+    FinishBuild();
+}
+
+//single producer, single consumer handoff that never blocks: the producer fills Back() and publishes it,
+//the consumer picks up the newest published slot, stale ones are simply overwritten
+template<typename T>
+struct TripleBuffer
+{
+    static const int fresh_bit = 4;
+
+    T slots[3];
+    std::atomic<int> middle{1};
+    int back = 0;
+    int front = 2;
+
+    T& Back()
+    {
+        return slots[back];
+    }
+
+    const T& Front() const
+    {
+        return slots[front];
+    }
+
+    void Publish()
+    {
+        back = middle.exchange(back | fresh_bit) & ~fresh_bit;
+    }
+
+    //true if the last published slot was not picked up yet
+    bool Pending() const
+    {
+        return (middle.load() & fresh_bit) != 0;
+    }
+
+    //swaps the newest published slot into Front(), false if nothing new was published
+    bool Acquire()
+    {
+        if (!Pending())
+            return false;
+
+        front = middle.exchange(front) & ~fresh_bit;
+        return true;
+    }
+};
+
+double Seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//per phase CPU time and frame interval jitter, printed and reset once per second
+struct FrameTimings
+{
+    std::string name;
+    std::vector<std::string> phase_names;
+    std::vector<double> phase_seconds;
+
+    double report_time = 0;
+    double last_frame = 0;
+    int frames = 0;
+    int intervals = 0;
+    double interval_sum = 0;
+    double interval_squares = 0;
+
+    FrameTimings(const char* name, std::vector<std::string> phase_names)
+        : name(name), phase_names(phase_names), phase_seconds(phase_names.size())
+    {
+    }
+
+    void Phase(size_t phase, double seconds)
+    {
+        phase_seconds[phase] += seconds;
+    }
+
+    void Frame(double now)
+    {
+        ++frames;
+        if (last_frame > 0)
+        {
+            auto interval = now - last_frame;
+            interval_sum += interval;
+            interval_squares += interval * interval;
+            ++intervals;
+        }
+        last_frame = now;
+
+        if (report_time == 0)
+            report_time = now;
+        if (now - report_time < 1 || intervals == 0)
+            return;
+
+        auto mean = interval_sum / intervals;
+        auto jitter = sqrt(std::max(0., interval_squares / intervals - mean * mean));
+
+        std::ostringstream report;
+        report << name << ": " << mean * 1000 << " ms/frame, jitter " << jitter * 1000 << " ms |";
+        for (size_t i = 0; i < phase_names.size(); ++i)
+            report << " " << phase_names[i] << " " << phase_seconds[i] * 1000 / frames << " ms";
+        std::cout << report.str() << std::endl;
+
+        report_time = now;
+        frames = 0;
+        intervals = 0;
+        interval_sum = 0;
+        interval_squares = 0;
+        std::fill(phase_seconds.begin(), phase_seconds.end(), 0.);
+    }
+};
+
+//picks the render scale that holds a GPU time budget. Each measurement is divided by the pixel fraction it was
+//taken at, so the estimate does not depend on the scale that produced it. With a fixed per frame cost on top of
+//the per pixel one the update still moves monotonically to the budget, the query latency cannot make it swing
+struct ResolutionController
+{
+    double target_seconds;
+    double min_scale = 0.25;
+    double max_scale = 1;
+    double scale = 1;
+    //smoothed GPU seconds of a frame at full resolution
+    double full_cost = 0;
+
+    ResolutionController(double target_seconds)
+        : target_seconds(target_seconds)
+    {
+    }
+
+    void Measured(double seconds, double at_scale)
+    {
+        auto cost = seconds / (at_scale * at_scale);
+        full_cost = full_cost == 0 ? cost : full_cost + (cost - full_cost) * 0.2;
+
+        auto ideal = glm::clamp(sqrt(target_seconds / full_cost), min_scale, max_scale);
+        //a dead band against measurement noise, and shrinking goes faster than growing back
+        if (std::abs(ideal - scale) < 0.03 * scale)
+            return;
+        scale = glm::clamp(ideal, scale - 0.1, scale + 0.02);
+    }
+};
+
+/* Memory statistics */
+size_t PeakResidentBytes()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return size_t(usage.ru_maxrss);
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+size_t CurrentResidentBytes()
+{
+#ifdef __APPLE__
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+        return 0;
+    return size_t(info.resident_size);
+#else
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    if (!(statm >> pages >> resident))
+        return 0;
+    return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+/* OpenGL Utility Functions */
+//past the 3.3 core glad was generated for
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+GLuint CreateShaderFromSource(const GLenum& shader_type, const GLchar * source)
+{
+    GLuint shader = glCreateShader(shader_type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    int success;
+    char info_log[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        std::cout << "Error: Shader Compilation failed" << std::endl;
+        glGetShaderInfoLog(shader, 512, NULL, info_log);
+        std::cout << info_log << std::endl;
+
+        glDeleteShader(shader);
+        return NULL;
+    }
+
+    return shader;
+}
+
+//compiles and links without asking for the result, so the driver can work on it while the caller does something else
+GLuint BeginProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source)
+{
+    GLuint program = glCreateProgram();
+
+    const GLchar * sources[] = { vertex_shader_source, fragment_shader_source };
+    const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    for (int i = 0; i < 2; ++i)
+    {
+        GLuint shader = glCreateShader(types[i]);
+        glShaderSource(shader, 1, &sources[i], NULL);
+        glCompileShader(shader);
+        glAttachShader(program, shader);
+
+        //only flagged, it goes away along with the program
+        glDeleteShader(shader);
+    }
+
+    glLinkProgram(program);
+    return program;
+}
+
+//waits for a program from BeginProgramFromSources, returns 0 and prints the logs if it failed
+GLuint FinishProgram(GLuint program)
+{
+    int success;
+    char info_log[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        GLuint shaders[2];
+        GLsizei shader_count = 0;
+        glGetAttachedShaders(program, 2, &shader_count, shaders);
+        for (GLsizei i = 0; i < shader_count; ++i)
+        {
+            glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                std::cout << "Error: Shader Compilation failed" << std::endl;
+                glGetShaderInfoLog(shaders[i], 512, NULL, info_log);
+                std::cout << info_log << std::endl;
+            }
+        }
+
+        std::cout << "Error: Program Linking failed" << std::endl;
+        glGetProgramInfoLog(program, 512, NULL, info_log);
+        std::cout << info_log << std::endl;
+
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    //the driver's own copy is not visible, the size of its program binary is the closest there is. Without
+    //ProgramBinaryLengthSupported the programs go uncounted. They are no mesh, so they get a tag of their own
+    GLint binary_length = 0;
+    if (Globals.program_binary_length)
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+    if (binary_length > 0)
+        Globals.memory.Committed(MemoryTracker::program_storage, program, Globals.memory.Find("shader programs", "programs"), binary_length);
+
+    return program;
+}
+
+GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source)
+{
+    return FinishProgram(BeginProgramFromSources(vertex_shader_source, fragment_shader_source));
+}
+
+//GL_PROGRAM_BINARY_LENGTH needs GL 4.1 or ARB_get_program_binary, checked once instead of per program
+bool ProgramBinaryLengthSupported()
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 1))
+        return true;
+
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; ++i)
+    {
+        auto extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+        if (extension != NULL && std::string(extension) == "GL_ARB_get_program_binary")
+            return true;
+    }
+    return false;
+}
+
+/* Parallel shader compilation, KHR_parallel_shader_compile is past the 3.3 core glad was generated for */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+//lets the driver compile on its own threads, false if it can't
+bool EnableParallelShaderCompile()
+{
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; ++i)
+    {
+        auto extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+        if (extension == NULL)
+            continue;
+
+        std::string name = extension;
+        if (name != "GL_KHR_parallel_shader_compile" && name != "GL_ARB_parallel_shader_compile")
+            continue;
+
+        typedef void (*MaxShaderCompilerThreads)(GLuint);
+        auto max_threads = reinterpret_cast<MaxShaderCompilerThreads>(glfwGetProcAddress(
+            name == "GL_KHR_parallel_shader_compile" ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB"));
+        if (max_threads == NULL)
+            continue;
+
+        //0xFFFFFFFF leaves the thread count to the driver
+        max_threads(0xFFFFFFFF);
+        Globals.parallel_shader_compile = true;
+    }
+    return Globals.parallel_shader_compile;
+}
+
+//true if FinishProgram won't block, unknown without the extension, so then always true
+bool ProgramCompletionReady(GLuint program)
+{
+    if (!Globals.parallel_shader_compile)
+        return true;
+
+    GLint complete = GL_FALSE;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+}
+
+/* Fun Stuff */
+//the commented out modulation of GenerateParametricShape, animated over time
+glm::dvec3 DeformedParametricSurface(glm::dvec2(*parametric_line)(double), double t, double r, double time)
+{
+    auto p = glm::dvec3(parametric_line(t), 0);
+
+    auto s = sin(r * glm::two_pi<double>() * 6 + time * 2) * 0.15 + 1;
+    p.x *= s;
+    p.y *= sin(r * glm::two_pi<double>() * 3 - time) * 0.25 + 1;
+    return glm::rotateY(p, r * glm::two_pi<double>());
+}
+
+/* Parametric surface that is regenerated every frame and streamed to the GPU */
+struct StreamingSurface
+{
+    //number of vertex buffer slots in flight, each guarded by its own fence
+    static const int ring_size = 3;
+
+    std::string name;
+
+    GLuint id;
+
+    GLuint vertex_buffer;
+    GLsizei vertex_count;
+    GLsizeiptr slot_size;
+    GLsync fences[ring_size] = {};
+    int slot = 0;
+
+    GLuint element_array_buffer;
+    GLsizei element_array_count;
+
+    glm::dvec2(*parametric_line)(double);
+    int vertical_segments;
+    int rotation_segments;
+
+    //surface samples padded with one extra row on each end of v, for the normals
+    TrackedVector<glm::dvec3> samples;
+
+    //statistics, printed and reset once per second
+    double report_time = 0;
+    int frame_count = 0;
+    double generation_seconds = 0;
+    double uploaded_bytes = 0;
+    int stall_count = 0;
+    double stall_seconds = 0;
+
+    StreamingSurface(const std::string& name, glm::dvec2(*parametric_line)(double), int vertical_segments, int rotation_segments)
+        : name(name), parametric_line(parametric_line), vertical_segments(vertical_segments), rotation_segments(rotation_segments),
+          samples(TrackedAllocator<glm::dvec3>(Globals.memory.Find(name, "samples")))
+    {
+        vertex_count = GLsizei(vertical_segments * rotation_segments);
+        samples.resize((vertical_segments + 2) * rotation_segments);
+
+        //every slot holds all positions followed by all normals
+        slot_size = GLsizeiptr(vertex_count) * 2 * sizeof(glm::vec3);
+
+        glGenVertexArrays(1, &id);
+        glBindVertexArray(id);
+
+        glGenBuffers(1, &vertex_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        Globals.memory.BufferData(GL_ARRAY_BUFFER, vertex_buffer, slot_size * ring_size, NULL, GL_STREAM_DRAW, name, "vertex ring");
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<void *>(0));
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void *>(vertex_count * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(1);
+
+        //the topology never changes, only the vertices move
+        element_array_count = GLsizei(rotation_segments * (vertical_segments - 1) * 6);
+
+        glGenBuffers(1, &element_array_buffer);
+        VAO::FillBuffer<GLuint>(GL_ELEMENT_ARRAY_BUFFER, element_array_buffer, element_array_count, name, "indices", [&](GLuint* indices)
+        {
+            GenerateGridIndices(indices, vertical_segments, rotation_segments, 0, rotation_segments);
+        });
+    }
+
+    //generates the surface at the given time into the next free slot of the ring
+    void Update(WorkerPool& workers, double time)
+    {
+        using clock = std::chrono::steady_clock;
+
+        slot = (slot + 1) % ring_size;
+
+        //the GPU may still be reading this slot from ring_size frames ago
+        if (fences[slot] != NULL)
+        {
+            if (glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                auto stall_start = clock::now();
+                while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+                stall_seconds += std::chrono::duration<double>(clock::now() - stall_start).count();
+                ++stall_count;
+            }
+            glDeleteSync(fences[slot]);
+            fences[slot] = NULL;
+        }
+
+        auto generation_start = clock::now();
+
+        //the fence already synchronized the slot, so skip the driver's own implicit sync
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        auto mapped = static_cast<glm::vec3 *>(glMapBufferRange(
+            GL_ARRAY_BUFFER, slot * slot_size, slot_size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+        ));
+        if (mapped == NULL)
+        {
+            std::cout << "Error: Mapping the streaming vertex buffer failed" << std::endl;
+            return;
+        }
+
+        int padded_segments = vertical_segments + 2;
+        workers.ParallelFor(rotation_segments, [&](int begin, int end)
+        {
+            for (int r = begin; r < end; ++r)
+                for (int v = -1; v <= vertical_segments; ++v)
+                    samples[r * padded_segments + v + 1] = DeformedParametricSurface(
+                        parametric_line, v / double(vertical_segments - 1), r / double(rotation_segments), time
+                    );
+        });
+
+        //same central differences as GenerateParametricShape, read from the neighbouring samples
+        auto normals = mapped + vertex_count;
+        workers.ParallelFor(rotation_segments, [&](int begin, int end)
+        {
+            for (int r = begin; r < end; ++r)
+            {
+                auto row = &samples[r * padded_segments + 1];
+                auto next_row = &samples[((r + 1) % rotation_segments) * padded_segments + 1];
+                auto prev_row = &samples[((r + rotation_segments - 1) % rotation_segments) * padded_segments + 1];
+
+                for (int v = 0; v < vertical_segments; ++v)
+                {
+                    auto tangent_v = (row[v + 1] - row[v - 1]) / 2.;
+                    auto tangent_r = (next_row[v] - prev_row[v]) / 2.;
+
+                    mapped[r * vertical_segments + v] = row[v];
+                    normals[r * vertical_segments + v] = glm::normalize(glm::cross(tangent_r, tangent_v));
+                }
+            }
+        });
+
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        generation_seconds += std::chrono::duration<double>(clock::now() - generation_start).count();
+        uploaded_bytes += double(slot_size);
+    }
+
+    //expects its vertex array to be bound
+    void Draw()
+    {
+        glDrawElementsBaseVertex(GL_TRIANGLES, element_array_count, GL_UNSIGNED_INT, NULL, slot * vertex_count * 2);
+
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void Report(double now)
+    {
+        ++frame_count;
+        if (now - report_time < 1)
+            return;
+
+        auto elapsed = now - report_time;
+        if (report_time > 0)
+            std::cout << "Animated surface " << vertical_segments << "x" << rotation_segments << ": "
+                      << frame_count / elapsed << " FPS, "
+                      << generation_seconds * 1000 / frame_count << " ms generation, "
+                      << uploaded_bytes / elapsed / (1024 * 1024) << " MB/s upload, "
+                      << stall_count << " stalls (" << stall_seconds * 1000 << " ms)" << std::endl;
+
+        report_time = now;
+        frame_count = 0;
+        generation_seconds = 0;
+        uploaded_bytes = 0;
+        stall_count = 0;
+        stall_seconds = 0;
+    }
+};
+
+/* Frame Capture */
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    static uint32_t table[256] = {};
+    if (table[1] == 0)
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+//RGB PNG with stored (uncompressed) deflate blocks, no zlib needed and cheap enough to keep up with rendering
+//rgba is bottom-up, the way glReadPixels returns it
+bool WritePng(const std::string& path, const uint8_t* rgba, int width, int height)
+{
+    std::vector<uint8_t> raw;
+    raw.reserve(size_t(width * 3 + 1) * height);
+    for (int y = height - 1; y >= 0; --y)
+    {
+        raw.push_back(0); //no filter
+        auto row = rgba + size_t(y) * width * 4;
+        for (int x = 0; x < width; ++x)
+            raw.insert(raw.end(), row + x * 4, row + x * 4 + 3);
+    }
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    uint32_t adler_a = 1, adler_b = 0;
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535)
+    {
+        auto size = std::min<size_t>(65535, raw.size() - offset);
+        zlib.push_back(offset + size == raw.size() ? 1 : 0);
+        zlib.push_back(uint8_t(size));
+        zlib.push_back(uint8_t(size >> 8));
+        zlib.push_back(uint8_t(~size));
+        zlib.push_back(uint8_t(~size >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+
+        for (size_t i = offset; i < offset + size; ++i)
+        {
+            adler_a = (adler_a + raw[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    auto adler = (adler_b << 16) | adler_a;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        zlib.push_back(uint8_t(adler >> shift));
+
+    std::ofstream file(path, std::ios::binary);
+    auto WriteChunk = [&file](const char* type, const std::vector<uint8_t>& data)
+    {
+        uint8_t header[8] = {
+            uint8_t(data.size() >> 24), uint8_t(data.size() >> 16), uint8_t(data.size() >> 8), uint8_t(data.size()),
+            uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3])
+        };
+        auto crc = Crc32(Crc32(0, header + 4, 4), data.data(), data.size());
+        uint8_t footer[4] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+
+        file.write(reinterpret_cast<const char*>(header), 8);
+        file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+        file.write(reinterpret_cast<const char*>(footer), 4);
+    };
+
+    file.write("\x89PNG\r\n\x1a\n", 8);
+    WriteChunk("IHDR", {
+        uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+        uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+        8, 2, 0, 0, 0 //8 bit RGB
+    });
+    WriteChunk("IDAT", zlib);
+    WriteChunk("IEND", {});
+    return bool(file);
+}
+
+//appends one 4:4:4 BT.601 frame to a YUV4MPEG2 stream, rgba is bottom-up
+void WriteY4mFrame(std::ofstream& file, const uint8_t* rgba, int width, int height, std::vector<uint8_t>& planes)
+{
+    auto plane_size = size_t(width) * height;
+    planes.resize(plane_size * 3);
+    for (int y = 0; y < height; ++y)
+    {
+        auto row = rgba + size_t(height - 1 - y) * width * 4;
+        for (int x = 0; x < width; ++x)
+        {
+            float r = row[x * 4], g = row[x * 4 + 1], b = row[x * 4 + 2];
+            auto i = size_t(y) * width + x;
+            planes[i] = uint8_t(16 + (65.738f * r + 129.057f * g + 25.064f * b) / 256);
+            planes[plane_size + i] = uint8_t(128 + (-37.945f * r - 74.494f * g + 112.439f * b) / 256);
+            planes[plane_size * 2 + i] = uint8_t(128 + (112.439f * r - 94.154f * g - 18.285f * b) / 256);
+        }
+    }
+
+    file << "FRAME\n";
+    file.write(reinterpret_cast<const char*>(planes.data()), std::streamsize(planes.size()));
+}
+
+//reads the back buffer into a ring of pixel buffer objects and maps each one a few frames later,
+//when the GPU is done with it, then hands the pixels to an encoder thread
+struct FrameCapture
+{
+    static const int ring_size = 4;
+    //frames waiting for the encoder before new ones get dropped
+    static const size_t max_queued = 8;
+
+    GLuint pixel_buffers[ring_size];
+    GLsync fences[ring_size] = {};
+    glm::ivec2 sizes[ring_size];
+    glm::ivec2 allocated_sizes[ring_size];
+    int next = 0;
+    int pending = 0;
+
+    struct Frame
+    {
+        std::vector<uint8_t> pixels;
+        glm::ivec2 size;
+        int number;
+    };
+
+    std::string path;
+    bool y4m;
+    std::ofstream y4m_file;
+    glm::ivec2 y4m_size;
+    int frame_number = 0;
+
+    std::thread encoder;
+    std::mutex mutex;
+    std::condition_variable frame_ready;
+    std::vector<Frame> queue;
+    std::vector<std::vector<uint8_t>> free_pixels;
+    bool quit = false;
+
+    int encoded_count = 0;
+    int dropped_count = 0;
+    int stall_count = 0;
+
+    //a path ending in .y4m records a video, anything else is a directory for a PNG sequence
+    FrameCapture(const std::string& path)
+        : path(path), y4m(path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0)
+    {
+        if (!y4m)
+            mkdir(path.c_str(), 0755);
+
+        glGenBuffers(ring_size, pixel_buffers);
+        for (auto& size : allocated_sizes)
+            size = glm::ivec2(0);
+
+        encoder = std::thread([this]() { Encode(); });
+        std::cout << "Capturing to " << path << std::endl;
+    }
+
+    //call after the frame is submitted and before it is swapped
+    void ReadFrame(glm::ivec2 size)
+    {
+        //every buffer of the ring is in flight, the oldest one has to come back first
+        if (pending == ring_size)
+            RetireOldest(true);
+
+        auto i = next;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+        if (allocated_sizes[i] != size)
+        {
+            Globals.memory.BufferData(GL_PIXEL_PACK_BUFFER, pixel_buffers[i], GLsizeiptr(size.x) * size.y * 4, NULL, GL_STREAM_READ, "frame capture", "pixel buffers");
+            allocated_sizes[i] = size;
+        }
+
+        glReadBuffer(GL_BACK);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, static_cast<void *>(0));
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        sizes[i] = size;
+        next = (next + 1) % ring_size;
+        ++pending;
+
+        //collect whatever already finished, without waiting
+        while (pending > 0 && RetireOldest(false));
+    }
+
+    bool RetireOldest(bool wait)
+    {
+        auto i = (next - pending + ring_size) % ring_size;
+
+        if (glClientWaitSync(fences[i], 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            if (!wait)
+                return false;
+
+            ++stall_count;
+            while (glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fences[i]);
+        fences[i] = NULL;
+        --pending;
+
+        auto byte_count = size_t(sizes[i].x) * sizes[i].y * 4;
+        Frame frame = { {}, sizes[i], frame_number++ };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.size() >= max_queued)
+            {
+                ++dropped_count;
+                return true;
+            }
+            if (!free_pixels.empty())
+            {
+                frame.pixels.swap(free_pixels.back());
+                free_pixels.pop_back();
+            }
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+        auto mapped = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(byte_count), GL_MAP_READ_BIT));
+        if (mapped != NULL)
+        {
+            frame.pixels.assign(mapped, mapped + byte_count);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (mapped == NULL)
+        {
+            std::cout << "Error: Mapping a capture buffer failed" << std::endl;
+            return true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(frame));
+        }
+        frame_ready.notify_one();
+        return true;
+    }
+
+    void Encode()
+    {
+        std::vector<uint8_t> planes;
+        while (true)
+        {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frame_ready.wait(lock, [this]() { return quit || !queue.empty(); });
+                if (queue.empty())
+                    return;
+
+                frame = std::move(queue.front());
+                queue.erase(queue.begin());
+            }
+
+            bool written = true;
+            if (!y4m)
+            {
+                char name[32];
+                snprintf(name, sizeof(name), "/frame_%05d.png", frame.number);
+                WritePng(path + name, frame.pixels.data(), frame.size.x, frame.size.y);
+            }
+            else if (!y4m_file.is_open() || frame.size == y4m_size)
+            {
+                //the stream has one size for all of its frames
+                if (!y4m_file.is_open())
+                {
+                    y4m_size = frame.size;
+                    y4m_file.open(path, std::ios::binary);
+                    y4m_file << "YUV4MPEG2 W" << y4m_size.x << " H" << y4m_size.y << " F60:1 Ip A1:1 C444\n";
+                }
+                WriteY4mFrame(y4m_file, frame.pixels.data(), frame.size.x, frame.size.y, planes);
+            }
+            else
+                written = false; //the window was resized while recording a video
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (written)
+                ++encoded_count;
+            else
+                ++dropped_count;
+            free_pixels.push_back(std::move(frame.pixels));
+        }
+    }
+
+    //an early exit may drop a capture that was never stopped, the context has to be current still
+    ~FrameCapture()
+    {
+        if (encoder.joinable())
+            Stop();
+    }
+
+    //reads back the frames still in flight, waits for the encoder and releases the buffers
+    void Stop()
+    {
+        while (pending > 0)
+            RetireOldest(true);
+        glDeleteBuffers(ring_size, pixel_buffers);
+        for (auto buffer : pixel_buffers)
+            Globals.memory.Released(MemoryTracker::buffer_storage, buffer);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        frame_ready.notify_one();
+        encoder.join();
+
+        std::cout << "Captured " << encoded_count << " frames to " << path << ", "
+                  << dropped_count << " dropped, " << stall_count << " readback stalls" << std::endl;
+    }
+};
+
+/* Dynamic Resolution */
+//renders the frame into an offscreen framebuffer at a fraction of the window size and stretches it to the back
+//buffer with a bilinear blit. The scene pass is timed with GPU queries, read back a few frames later without waiting
+struct DynamicResolution
+{
+    static const int query_count = 4;
+
+    GLuint framebuffer;
+    GLuint color_renderbuffer;
+    GLuint depth_renderbuffer;
+    //storage stays at the window size, lower scales render into its lower left corner
+    glm::ivec2 allocated_size = glm::ivec2(0);
+
+    GLuint queries[query_count];
+    double query_scales[query_count];
+    int query_frames[query_count];
+    bool query_pending[query_count] = {};
+    int next_query = 0;
+    bool timing = false;
+
+    ResolutionController controller;
+    glm::ivec2 render_size;
+    int frame = 0;
+    double last_frame_time = 0;
+
+    //per frame CSV, and a summary on stdout once per second
+    std::ofstream log;
+    double report_time = 0;
+    int report_frames = 0;
+    double report_min_scale = 1;
+    double report_max_scale = 0;
+    double report_gpu_seconds = 0;
+    int report_measurements = 0;
+
+    DynamicResolution(double target_seconds, const std::string& log_path)
+        : controller(target_seconds), log(log_path)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &color_renderbuffer);
+        glGenRenderbuffers(1, &depth_renderbuffer);
+        glGenQueries(query_count, queries);
+
+        if (!log)
+            std::cout << "Error: Could not open " << log_path << std::endl;
+        log << "frame,scale,width,height,frame_ms,measured_frame,scene_gpu_ms" << std::endl;
+        std::cout << "Dynamic resolution on, scene budget " << target_seconds * 1000 << " ms, logging to " << log_path << std::endl;
+    }
+
+    ~DynamicResolution()
+    {
+        glDeleteQueries(query_count, queries);
+        glDeleteRenderbuffers(1, &depth_renderbuffer);
+        glDeleteRenderbuffers(1, &color_renderbuffer);
+        Globals.memory.Released(MemoryTracker::renderbuffer_storage, depth_renderbuffer);
+        Globals.memory.Released(MemoryTracker::renderbuffer_storage, color_renderbuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+
+    //call before the frame is cleared, everything up to End lands in the offscreen framebuffer
+    void Begin(glm::ivec2 viewport)
+    {
+        if (allocated_size != viewport)
+            Allocate(viewport);
+
+        auto now = Seconds();
+        auto frame_seconds = last_frame_time > 0 ? now - last_frame_time : 0;
+        last_frame_time = now;
+
+        //feed whatever finished, oldest first
+        int measured_frame = -1;
+        double measured_seconds = 0;
+        for (int i = 0; i < query_count; ++i)
+        {
+            auto q = (next_query + i) % query_count;
+            if (!query_pending[q])
+                continue;
+
+            GLint available = 0;
+            glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &nanoseconds);
+            query_pending[q] = false;
+
+            measured_frame = query_frames[q];
+            measured_seconds = nanoseconds * 1e-9;
+            controller.Measured(measured_seconds, query_scales[q]);
+            report_gpu_seconds += measured_seconds;
+            ++report_measurements;
+        }
+
+        render_size = glm::max(glm::ivec2(glm::vec2(viewport) * float(controller.scale) + 0.5f), glm::ivec2(1));
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, render_size.x, render_size.y);
+
+        //with every query still in flight this frame goes untimed rather than stalling on the oldest
+        timing = !query_pending[next_query];
+        if (timing)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, queries[next_query]);
+            query_scales[next_query] = controller.scale;
+            query_frames[next_query] = frame;
+        }
+
+        log << frame << "," << controller.scale << "," << render_size.x << "," << render_size.y << "," << frame_seconds * 1000 << ",";
+        if (measured_frame >= 0)
+            log << measured_frame << "," << measured_seconds * 1000;
+        else
+            log << ",";
+        log << "\n";
+
+        Report(now);
+    }
+
+    //stretches the frame to the back buffer, before anything reads the back buffer
+    void End(glm::ivec2 viewport)
+    {
+        if (timing)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            query_pending[next_query] = true;
+            next_query = (next_query + 1) % query_count;
+        }
+        ++frame;
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, render_size.x, render_size.y, 0, 0, viewport.x, viewport.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, viewport.x, viewport.y);
+    }
+
+    void Allocate(glm::ivec2 size)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer);
+        Globals.memory.RenderbufferStorage(color_renderbuffer, GL_RGBA8, 4, size, "dynamic resolution", "color");
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+        //24 bit depth is padded to 4 bytes by every driver we know of
+        Globals.memory.RenderbufferStorage(depth_renderbuffer, GL_DEPTH_COMPONENT24, 4, size, "dynamic resolution", "depth");
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_renderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Error: Dynamic resolution framebuffer incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        allocated_size = size;
+    }
+
+    void Report(double now)
+    {
+        ++report_frames;
+        report_min_scale = std::min(report_min_scale, controller.scale);
+        report_max_scale = std::max(report_max_scale, controller.scale);
+
+        if (report_time == 0)
+            report_time = now;
+        if (now - report_time < 1)
+            return;
+
+        std::cout << "Dynamic resolution: scale " << report_min_scale << " - " << report_max_scale << " (" << render_size.x << "x"
+                  << render_size.y << "), scene " << (report_measurements > 0 ? report_gpu_seconds * 1000 / report_measurements : 0)
+                  << " ms GPU of " << controller.target_seconds * 1000 << " ms, " << report_frames << " frames" << std::endl;
+
+        report_time = now;
+        report_frames = 0;
+        report_min_scale = 1;
+        report_max_scale = 0;
+        report_gpu_seconds = 0;
+        report_measurements = 0;
+    }
+};
+
+/* Frame Packets */
+//one draw call along with the state it needs
+struct DrawCommand
+{
+    const VAO* vao;
+    StreamingSurface* surface;
+    GLuint program;
+    GLenum polygon_mode;
+    GLint transform_location;
+    glm::mat4 transform;
+    GLint color_location;
+    glm::vec3 color;
+    GLint mouse_position_location;
+};
+
+//everything needed to render one frame, built by the scene logic and handed to whoever owns the context
+struct FramePacket
+{
+    double time;
+    glm::ivec2 screen_dimensions;
+    glm::vec2 mouse_position;
+    int scene;
+    bool capture;
+    bool gl_state_report;
+    bool dynamic_resolution;
+    bool unique_edges;
+    std::vector<DrawCommand> draws;
+
+    void Draw(
+        const VAO& vao, GLuint program, GLenum polygon_mode, GLint transform_location, const glm::mat4& transform,
+        GLint color_location = -1, glm::vec3 color = glm::vec3(), GLint mouse_position_location = -1
+    )
+    {
+        draws.push_back({ &vao, NULL, program, polygon_mode, transform_location, transform, color_location, color, mouse_position_location });
+    }
+
+    //the surface is regenerated at the packet's time right before it is drawn
+    void Draw(
+        StreamingSurface& surface, GLuint program, GLenum polygon_mode, GLint transform_location, const glm::mat4& transform,
+        GLint color_location = -1, glm::vec3 color = glm::vec3(), GLint mouse_position_location = -1
+    )
+    {
+        draws.push_back({ NULL, &surface, program, polygon_mode, transform_location, transform, color_location, color, mouse_position_location });
+    }
+};
+
+/* Out-of-core export, the surface is produced in bands of rotation segments */
+struct ExportChunk
+{
+    int r_begin;
+    int r_end;
+    std::vector<char> bytes;
+};
+
+//x, y, z, nx, ny, nz as floats
+static const size_t ply_vertex_size = 6 * sizeof(float);
+//a uchar vertex count followed by three uint indices
+static const size_t ply_face_size = 1 + 3 * sizeof(uint32_t);
+
+void GenerateVertexChunk(ExportChunk& chunk, glm::dvec2(*parametric_line)(double), int vertical_segments, int rotation_segments)
+{
+    //one extra row on each side of the band and one extra sample on each end of v, for the normals
+    int rows = chunk.r_end - chunk.r_begin;
+    int padded_segments = vertical_segments + 2;
+    std::vector<glm::dvec3> samples(size_t(rows + 2) * padded_segments);
+
+    for (int i = 0; i < rows + 2; ++i)
+    {
+        int r = (chunk.r_begin - 1 + i + rotation_segments) % rotation_segments;
+        for (int v = -1; v <= vertical_segments; ++v)
+            samples[size_t(i) * padded_segments + v + 1] = ParametricSurface(
+                parametric_line, v / double(vertical_segments - 1), r / double(rotation_segments)
+            );
+    }
+
+    chunk.bytes.resize(size_t(rows) * vertical_segments * ply_vertex_size);
+    auto out = chunk.bytes.data();
+    for (int i = 1; i <= rows; ++i)
+    {
+        auto row = &samples[size_t(i) * padded_segments + 1];
+        auto next_row = row + padded_segments;
+        auto prev_row = row - padded_segments;
+
+        for (int v = 0; v < vertical_segments; ++v)
+        {
+            auto tangent_v = (row[v + 1] - row[v - 1]) / 2.;
+            auto tangent_r = (next_row[v] - prev_row[v]) / 2.;
+
+            glm::vec3 position = row[v];
+            glm::vec3 normal = glm::normalize(glm::cross(tangent_r, tangent_v));
+
+            float vertex[6] = { position.x, position.y, position.z, normal.x, normal.y, normal.z };
+            std::memcpy(out, vertex, ply_vertex_size);
+            out += ply_vertex_size;
+        }
+    }
+}
+
+void GenerateFaceChunk(ExportChunk& chunk, int vertical_segments, int rotation_segments)
+{
+    //same winding as GenerateGridIndices, the last band wraps around to the first row
+    auto VRtoIndex = [vertical_segments, rotation_segments](int v, int r) //2D to 1D map
+    {
+        return uint32_t(uint64_t(r % rotation_segments) * vertical_segments + v);
+    };
+
+    int rows = chunk.r_end - chunk.r_begin;
+    chunk.bytes.resize(size_t(rows) * (vertical_segments - 1) * 2 * ply_face_size);
+    auto out = chunk.bytes.data();
+    auto PushFace = [&out](uint32_t a, uint32_t b, uint32_t c)
+    {
+        *out++ = 3;
+        uint32_t face[3] = { a, b, c };
+        std::memcpy(out, face, sizeof(face));
+        out += sizeof(face);
+    };
+
+    for (int r = chunk.r_begin; r < chunk.r_end; ++r)
+        for (int v = 0; v < vertical_segments - 1; ++v)
+        {
+            PushFace(VRtoIndex(v + 1, r), VRtoIndex(v, r + 1), VRtoIndex(v, r));
+            PushFace(VRtoIndex(v + 1, r), VRtoIndex(v + 1, r + 1), VRtoIndex(v, r + 1));
+        }
+}
+
+
+//writes a binary little endian PLY, holding at most one band per worker in memory
+bool ExportParametricShape(
+    const char* path,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments,
+    WorkerPool& workers
+)
+{
+    uint64_t vertex_count = uint64_t(vertical_segments) * rotation_segments;
+    uint64_t face_count = uint64_t(vertical_segments - 1) * rotation_segments * 2;
+    if (vertical_segments < 2 || rotation_segments < 1 || vertex_count > UINT32_MAX)
+    {
+        std::cout << "Error: Unsupported export resolution " << vertical_segments << "x" << rotation_segments << std::endl;
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Error: Could not open " << path << std::endl;
+        return false;
+    }
+
+    file << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "comment parametric surface " << vertical_segments << "x" << rotation_segments << "\n"
+         << "element vertex " << vertex_count << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "element face " << face_count << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+
+    auto start = std::chrono::steady_clock::now();
+
+    //bands of about 16 MB of vertices
+    int rows_per_chunk = std::max(1, int((16 << 20) / (size_t(vertical_segments) * ply_vertex_size)));
+    std::vector<ExportChunk> chunks(workers.Size());
+
+    //PLY wants every vertex before the first face, so the bands are walked twice
+    for (int pass = 0; pass < 2; ++pass)
+        for (int r = 0; r < rotation_segments; r += rows_per_chunk * int(chunks.size()))
+        {
+            for (size_t i = 0; i < chunks.size(); ++i)
+            {
+                chunks[i].r_begin = std::min(rotation_segments, r + int(i) * rows_per_chunk);
+                chunks[i].r_end = std::min(rotation_segments, chunks[i].r_begin + rows_per_chunk);
+            }
+
+            workers.ParallelFor(int(chunks.size()), [&](int begin, int end)
+            {
+                for (int i = begin; i < end; ++i)
+                    if (pass == 0)
+                        GenerateVertexChunk(chunks[i], parametric_line, vertical_segments, rotation_segments);
+                    else
+                        GenerateFaceChunk(chunks[i], vertical_segments, rotation_segments);
+            });
+
+            for (auto& chunk : chunks)
+                file.write(chunk.bytes.data(), std::streamsize(chunk.bytes.size()));
+        }
+
+    file.close();
+    if (!file)
+    {
+        std::cout << "Error: Writing " << path << " failed" << std::endl;
+        return false;
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double bytes = double(vertex_count * ply_vertex_size + face_count * ply_face_size);
+    std::cout << "Exported " << vertical_segments << "x" << rotation_segments << " to " << path << ": "
+              << bytes / (1024 * 1024) << " MB in " << seconds << " s, "
+              << bytes / (1024 * 1024) / seconds << " MB/s, peak RSS "
+              << PeakResidentBytes() / (1024 * 1024) << " MB" << std::endl;
+    return true;
+}
+
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    InputSession::Event event;
+    event.type = InputSession::key_event;
+    event.key = key;
+    event.action = action;
+    event.mods = mods;
+    if (!Globals.input.Accept(event))
+        return;
+
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS){
+        glfwSetWindowShouldClose(window, GL_TRUE);
     }
     if (key == GLFW_KEY_Q && action == GLFW_PRESS){
         Globals.scene = 1;
@@ -220,14 +2517,193 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     if (key == GLFW_KEY_T && action == GLFW_PRESS){
         Globals.scene = 5;
     }
-        
-    if (key == GLFW_KEY_Y && action == GLFW_PRESS){
-        Globals.scene = 6;
+        
+    if (key == GLFW_KEY_Y && action == GLFW_PRESS){
+        Globals.scene = 6;
+    }
+
+    if (key == GLFW_KEY_U && action == GLFW_PRESS){
+        Globals.scene = 7;
+    }
+
+    if (key == GLFW_KEY_A && action == GLFW_PRESS){
+        Globals.adaptive_mesh = !Globals.adaptive_mesh;
+    }
+
+    if (key == GLFW_KEY_C && action == GLFW_PRESS){
+        Globals.capture = !Globals.capture;
+    }
+
+    //live GL state counters, once per second
+    if (key == GLFW_KEY_G && action == GLFW_PRESS){
+        Globals.gl_state_report = !Globals.gl_state_report;
+    }
+
+    //prints what is under the cursor and the query times
+    if (key == GLFW_KEY_P && action == GLFW_PRESS){
+        Globals.picking = !Globals.picking;
+    }
+
+    if (key == GLFW_KEY_D && action == GLFW_PRESS){
+        Globals.dynamic_resolution = !Globals.dynamic_resolution;
+    }
+
+    if (key == GLFW_KEY_L && action == GLFW_PRESS){
+        Globals.unique_edges = !Globals.unique_edges;
+    }
+
+    if (key == GLFW_KEY_M && action == GLFW_PRESS){
+        Globals.memory.Report("on demand (M)");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    auto startup_start = Seconds();
+
+    /* Offline export: MyApp --export <curve> <vertical_segments> <rotation_segments> <file.ply> */
+    if (argc > 1 && std::string(argv[1]) == "--export")
+    {
+        if (argc != 6)
+        {
+            std::cout << "Usage: " << argv[0] << " --export <curve> <vertical_segments> <rotation_segments> <file.ply>" << std::endl;
+            return -1;
+        }
+
+        for (const auto& curve : ParametricCurves)
+            if (std::string(argv[2]) == curve.name)
+            {
+                WorkerPool workers;
+                bool exported = ExportParametricShape(argv[5], curve.parametric_line, std::atoi(argv[3]), std::atoi(argv[4]), workers);
+                return exported ? 0 : -1;
+            }
+
+        std::cout << "Error: Unknown curve " << argv[2] << std::endl;
+        return -1;
+    }
+
+    std::string record_path;
+    std::string replay_path;
+    //options followed by a value, the value is taken as it is even if it starts with --
+    const std::vector<std::string> value_options = {
+        "--capture", "--curve", "--dynamic-resolution", "--resolution-log", "--mesh-budget",
+        "--wireframe-resolution", "--record", "--replay", "--frame-log", "--frame-log-baseline"
+    };
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (std::find(value_options.begin(), value_options.end(), option) != value_options.end() && i + 1 == argc)
+        {
+            std::cout << "Error: " << option << " needs a value" << std::endl;
+            return -1;
+        }
+
+        if (option == "--render-thread")
+            Globals.render_thread = true;
+
+        //--capture <directory or file.y4m> starts capturing right away, C toggles it
+        else if (option == "--capture")
+        {
+            Globals.capture = true;
+            Globals.capture_path = argv[++i];
+        }
+
+        else if (option == "--curve")
+            Globals.curve_source = argv[++i];
+
+        //--dynamic-resolution <budget ms> starts with it on, D toggles it
+        else if (option == "--dynamic-resolution")
+        {
+            Globals.dynamic_resolution = true;
+            Globals.frame_budget_ms = std::atof(argv[++i]);
+        }
+
+        else if (option == "--resolution-log")
+            Globals.resolution_log_path = argv[++i];
+
+        //meshes that would commit more GPU memory than this are built at a lower resolution
+        else if (option == "--mesh-budget")
+        {
+            Globals.memory.mesh_budget = (long long)(std::atof(argv[++i]) * 1024 * 1024);
+            if (Globals.memory.mesh_budget <= 0)
+            {
+                std::cout << "Error: --mesh-budget needs a size in MB" << std::endl;
+                return -1;
+            }
+        }
+
+        else if (option == "--wireframe-resolution")
+        {
+            Globals.wireframe_resolution = std::atoi(argv[++i]);
+            if (Globals.wireframe_resolution < 2)
+            {
+                std::cout << "Error: --wireframe-resolution needs at least 2 segments" << std::endl;
+                return -1;
+            }
+        }
+
+        else if (option == "--record")
+            record_path = argv[++i];
+
+        else if (option == "--replay")
+            replay_path = argv[++i];
+
+        else if (option == "--frame-log")
+            Globals.frame_log_path = argv[++i];
+
+        else if (option == "--frame-log-baseline")
+            Globals.frame_log_baseline_path = argv[++i];
+
+        else
+        {
+            std::cout << "Error: Unknown option " << option << std::endl;
+            return -1;
+        }
+    }
+
+    //only --dynamic-resolution turns it on before the first frame
+    if (Globals.dynamic_resolution && Globals.frame_budget_ms <= 0)
+    {
+        std::cout << "Error: --dynamic-resolution needs a budget in milliseconds" << std::endl;
+        return -1;
+    }
+
+    if (!record_path.empty() && !replay_path.empty())
+    {
+        std::cout << "Error: --record and --replay do not go together" << std::endl;
+        return -1;
+    }
+
+    //the render thread frames are split across two threads, their phases do not line up per frame
+    if (!Globals.frame_log_path.empty() && Globals.render_thread)
+    {
+        std::cout << "Error: --frame-log times the single threaded loop, it does not go with --render-thread" << std::endl;
+        return -1;
+    }
+
+    if (!Globals.frame_log_baseline_path.empty() && Globals.frame_log_path.empty())
+    {
+        std::cout << "Error: --frame-log-baseline needs --frame-log" << std::endl;
+        return -1;
+    }
+
+    //a replay opens the window at the recorded size
+    if (!record_path.empty() && !Globals.input.Record(record_path, Globals.screen_dimensions))
+        return -1;
+    if (!replay_path.empty() && !Globals.input.Replay(replay_path, Globals.screen_dimensions))
+        return -1;
+
+    ExpressionCurve curve;
+    if (!Globals.curve_source.empty())
+    {
+        std::string error;
+        if (!curve.Compile(Globals.curve_source, error))
+        {
+            std::cout << "Error: --curve: " << error << std::endl;
+            return -1;
+        }
     }
-}
 
-int main(void)
-{
     /* Set GLFW error callback */
     glfwSetErrorCallback(ErrorCallback);
 
@@ -268,113 +2744,192 @@ int main(void)
     /* Set GLFW Callbacks */
     glfwSetCursorPosCallback(window, CursorPositionCallback);
     glfwSetWindowSizeCallback(window, WindowSizeCallback);
+    glfwSetKeyCallback(window, key_callback);
 
     /* Configure OpenGL */
+    GLState gl_state;
     glClearColor(0, 0, 0, 0.1f);
-    glEnable(GL_DEPTH_TEST);
+    gl_state.DepthTest(true);
+
+    /* Creating OpenGL objects, the meshes are generated in the background while the driver compiles the programs */
+    std::cout << "RSS before meshes: " << CurrentResidentBytes() / (1024 * 1024) << " MB" << std::endl;
+    if (EnableParallelShaderCompile())
+        std::cout << "Parallel shader compilation enabled" << std::endl;
+    Globals.program_binary_length = ProgramBinaryLengthSupported();
 
-    /* Creating OpenGL objects */
-    std::vector<glm::vec3> positions;
-    std::vector<glm::vec3> normals;
-    std::vector<GLuint> indices;
+    WorkerPool workers;
+    MeshBuilder builder(workers);
 
-    auto ParametricHalfCircle = [](double t)
+    //GPU bytes of a grid mesh, for the budget
+    auto GridBytes = [](int vertical_segments, int rotation_segments)
     {
-        // [0, 1]
-        t -= 0.5;
-        // [-0.5, 0.5]
-        t *= glm::pi<double>();
-        // [-PI*0.5, PI*0.5]
-        return glm::dvec2(cos(t), sin(t));
+        return (long long)(vertical_segments) * rotation_segments * 2 * sizeof(glm::vec3) +
+               (long long)(rotation_segments) * (vertical_segments - 1) * 6 * sizeof(GLuint);
+    };
+    auto GridName = [](const char* curve, int vertical_segments, int rotation_segments)
+    {
+        return std::string(curve) + " " + std::to_string(vertical_segments) + "x" + std::to_string(rotation_segments);
     };
 
-    auto ParametricCircle = [](double t)
+    //program, baked at compile time like shape1 and shape3, see baked_shapes.h
+    VAO shape_VAO("ParametricCircle 16x16", BakedCircle16x16);
+    
+    //program_1
+    VAO shape1_VAO("ParametricHalfCircle 16x16", BakedHalfCircle16x16);
+    
+    //program_2, with its edge list
+    int shape2_vertical_segments = Globals.wireframe_resolution > 0 ? Globals.wireframe_resolution : 60;
+    int shape2_rotation_segments = Globals.wireframe_resolution > 0 ? Globals.wireframe_resolution : 20;
+    Globals.memory.FitBudget("ParametricSpikyCircle wireframe", shape2_vertical_segments, shape2_rotation_segments, [&](int v, int r)
+    {
+        return GridBytes(v, r) + (long long)(r) * (3 * v - 2) * 2 * sizeof(GLuint);
+    });
+    VAO shape2_VAO(GridName("ParametricSpikyCircle", shape2_vertical_segments, shape2_rotation_segments),
+                   ParametricSpikyCircle, shape2_vertical_segments, shape2_rotation_segments, &builder);
+    
+    //program_3
+    VAO shape3_VAO("ParametricSpikes 12x6", BakedSpikes12x6);
+
+    //the wireframes of scenes 0 and 1
+    shape_VAO.CreateEdges(16, 16);
+    shape1_VAO.CreateEdges(16, 16);
+    shape2_VAO.CreateEdges(shape2_vertical_segments, shape2_rotation_segments);
+    shape3_VAO.CreateEdges(12, 6);
+
+    //ParametricSpikyCircle unless --curve gave one, the profile is tabulated once and shared by all rows
+    int sixth_vertical_segments = 1024;
+    int sixth_rotation_segments = 1024;
+    Globals.memory.FitBudget("scene 6 uniform mesh", sixth_vertical_segments, sixth_rotation_segments, GridBytes);
+    auto sixth_v = sixth_vertical_segments;
+    auto sixth_r = sixth_rotation_segments;
+    VAO::RowGenerator sixth_generator = [=](glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)
     {
-        // [0, 1]
-        //t -= 0.5;
-        // [-0.5, 0.5]
-        t *= glm::two_pi<double>();
-        // [-PI, PI]
+        GenerateParametricPositions(positions, ParametricSpikyCircle, sixth_v, sixth_r, r_begin, r_end);
+        GenerateParametricNormals(normals, ParametricSpikyCircle, sixth_v, sixth_r, r_begin, r_end);
+        GenerateGridIndices(indices, sixth_v, sixth_r, r_begin, r_end);
+    };
+    if (!Globals.curve_source.empty())
+    {
+        auto profile = curve.Profile(sixth_v);
+        sixth_generator = [=](glm::vec3* positions, glm::vec3* normals, GLuint* indices, int r_begin, int r_end)
+        {
+            GenerateProfilePositions(positions, profile, sixth_r, r_begin, r_end);
+            GenerateProfileNormals(normals, profile, sixth_r, r_begin, r_end);
+            GenerateGridIndices(indices, sixth_v, sixth_r, r_begin, r_end);
+        };
+    }
+    VAO sixth_VAO(GridName(Globals.curve_source.empty() ? "ParametricSpikyCircle" : "--curve", sixth_v, sixth_r),
+                  sixth_v * sixth_r, sixth_r * (sixth_v - 1) * 6, sixth_r, sixth_generator, &builder);
+
+    //same error bound as the uniform mesh, the mesh itself is created once the samples are known
+    double sixth_error = 0;
+    std::vector<double> adaptive_samples;
+    int adaptive_rotation_segments = 0;
+    std::unique_ptr<VAO> adaptive_sixth_VAO;
+    auto adaptive_ticket = builder.Enqueue([&, sixth_v, sixth_r](WorkerPool&)
+    {
+        sixth_error = SampledSurfaceError(ParametricSpikyCircle, UniformProfileSamples(sixth_v), sixth_r);
+        adaptive_rotation_segments = AdaptiveSurfaceSamples(adaptive_samples, ParametricSpikyCircle, sixth_error, glm::radians(10.), sixth_v, sixth_r);
+
+        //over budget, keep an evenly spread subset of the samples, the ends included
+        int sample_count = int(adaptive_samples.size());
+        Globals.memory.FitBudget("scene 6 adaptive mesh", sample_count, adaptive_rotation_segments, GridBytes);
+        if (sample_count < int(adaptive_samples.size()))
+        {
+            std::vector<double> fewer(sample_count);
+            for (int i = 0; i < sample_count; ++i)
+                fewer[i] = adaptive_samples[size_t(i) * (adaptive_samples.size() - 1) / (sample_count - 1)];
+            adaptive_samples.swap(fewer);
+        }
+    });
 
-        //glm::dvec2 c(0.5, 0);
-        auto c = glm::dvec2(0.7, 0);
-        double r = 0.25;
+    /* Picking, a BVH per mesh, built on the builder thread the first time picking is on (P) and released when it is
+       turned off. Until then only the way to regenerate the mesh is kept */
+    struct PickingMesh
+    {
+        std::string name;
+        VAO::RowGenerator generate;
+        int rows;
+        size_t vertex_count;
+        size_t element_array_count;
+        //-1 while there is no BVH and none is being built
+        int ticket = -1;
+        long long bytes = 0;
+        MeshBVH bvh;
+    };
+    std::map<const VAO*, PickingMesh> picking;
 
-        return glm::dvec2(cos(t), sin(t)) * r + c;
+    auto RegisterPicking = [&](const VAO& vao)
+    {
+        auto& mesh = picking[&vao];
+        mesh.name = vao.name;
+        mesh.generate = vao.generate;
+        mesh.rows = vao.rows;
+        mesh.vertex_count = size_t(vao.vertex_count);
+        mesh.element_array_count = size_t(vao.element_array_count);
     };
 
-    auto ParametricSpikes = [](double t)
+    //serial on the builder thread, the shared WorkerPool runs one ParallelFor at a time and the animated surface
+    //needs it every frame, a BVH pass over a large mesh would hold up the frames while it runs
+    auto EnqueuePicking = [&](PickingMesh& mesh)
     {
-        // [0, 1]
-        t -= 0.5;
-        // [-0.5, 0.5]
-        t *= glm::two_pi<double>();
-        // [-PI, PI]
+        mesh.ticket = builder.Enqueue([&mesh](WorkerPool&)
+        {
+            auto start = Seconds();
+            auto tag = Globals.memory.Find(mesh.name, "picking");
+            auto& bvh = mesh.bvh;
+            bvh.positions.resize(mesh.vertex_count);
+            bvh.indices.resize(mesh.element_array_count);
+            {
+                TrackedVector<glm::vec3> normals(mesh.vertex_count, TrackedAllocator<glm::vec3>(tag));
+                mesh.generate(bvh.positions.data(), normals.data(), bvh.indices.data(), 0, mesh.rows);
+            }
+            BuildMeshBVH(bvh);
 
-        auto c = glm::dvec2(0.7, 0);
-        double r = 0.25;
+            //every mesh here is a grid, its triangles can be worked out from the grid instead
+            DropGridIndices(bvh, int(mesh.vertex_count) / mesh.rows, mesh.rows);
 
-        int a = 2 + 4 * 4;
-        return (glm::dvec2(cos(t) + sin(a*t) / a, sin(t) + cos(a*t) / a) / 2.) * r + c;
+            //the BVH lives in picking.h's plain vectors, counted once it is complete until ReleasePicking
+            mesh.bytes = (long long)(bvh.positions.capacity() * sizeof(glm::vec3) + bvh.indices.capacity() * sizeof(GLuint) +
+                                     bvh.triangles.capacity() * sizeof(bvh.triangles[0]) + bvh.nodes.capacity() * sizeof(BVHNode));
+            tag->Add(MemoryTracker::cpu, mesh.bytes);
+
+            std::cout << "Picking BVH " << mesh.name << ": " << bvh.triangles.size() << " triangles, " << bvh.nodes.size()
+                      << " nodes, " << mesh.bytes / (1024 * 1024) << " MB, built in " << (Seconds() - start) * 1000 << " ms" << std::endl;
+        });
     };
-    
-    auto ParametricSpikyCircle = [](double t)
-    {
-          // [0, 1]
-          t *= glm::two_pi<double>();
-          // [0, 2*PI]
 
-          glm::dvec2 c(0.6, 0);
-          double r = 0.35;
-          int a = 1 + 2 * 6;
-        
-          return glm::dvec2(cos(t) + sin(a*t) / a, sin(t) + cos(a*t) / a) * r + c;
+    //frees the BVHs while picking is off, ones still being built go once they are done
+    auto ReleasePicking = [&]()
+    {
+        for (auto& entry : picking)
+        {
+            auto& mesh = entry.second;
+            if (mesh.ticket < 0 || !builder.Finished(mesh.ticket))
+                continue;
+
+            Globals.memory.Find(mesh.name, "picking")->Add(MemoryTracker::cpu, -mesh.bytes);
+            mesh.bytes = 0;
+            mesh.bvh = MeshBVH();
+            mesh.ticket = -1;
+        }
     };
 
-    
+    RegisterPicking(shape_VAO);
+    RegisterPicking(shape1_VAO);
+    RegisterPicking(shape2_VAO);
+    RegisterPicking(shape3_VAO);
+    RegisterPicking(sixth_VAO);
 
-    
-    
-    //program
-    /* Creating OpenGL objects */
-    GenerateParametricShape(positions, normals, indices, ParametricCircle, 16, 16);
-    VAO shape_VAO(positions, normals, indices);
-    
-    //program_1
-    /* Creating OpenGL objects */
-    std::vector<glm::vec3> positions_1;
-    std::vector<glm::vec3> normals_1;
-    std::vector<GLuint> indices_1;
-    GenerateParametricShape(positions_1, normals_1, indices_1, ParametricHalfCircle, 16, 16);
-    VAO shape1_VAO(positions_1, normals_1, indices_1);
-    
-    //program_2
-    /* Creating OpenGL objects */
-    std::vector<glm::vec3> positions_2;
-    std::vector<glm::vec3> normals_2;
-    std::vector<GLuint> indices_2;
-    GenerateParametricShape(positions_2, normals_2, indices_2, ParametricSpikyCircle, 60, 20);
-    VAO shape2_VAO(positions_2, normals_2, indices_2);
-    
-    //program_3
-    /* Creating OpenGL objects */
-    std::vector<glm::vec3> positions_3;
-    std::vector<glm::vec3> normals_3;
-    std::vector<GLuint> indices_3;
-    GenerateParametricShape(positions_3, normals_3, indices_3, ParametricSpikes, 12, 6);
-    VAO shape3_VAO(positions_3, normals_3, indices_3);
-    
-    
-    
-    
-    
-     
-    /* Creating OpenGL objects */
-    std::vector<glm::vec3> six_positions;
-    std::vector<glm::vec3> six_normals;
-    std::vector<GLuint> six_indices;
-    GenerateParametricShape(six_positions, six_normals, six_indices, ParametricSpikyCircle, 1024, 1024);
-    VAO sixth_VAO(six_positions, six_normals, six_indices);
+    /* Animated surface, regenerated on the worker threads every frame */
+    int animated_vertical_segments = 512;
+    int animated_rotation_segments = 512;
+    Globals.memory.FitBudget("animated surface", animated_vertical_segments, animated_rotation_segments, [&](int v, int r)
+    {
+        return (long long)(v) * r * 2 * sizeof(glm::vec3) * StreamingSurface::ring_size + (long long)(r) * (v - 1) * 6 * sizeof(GLuint);
+    });
+    StreamingSurface animated_surface(GridName("animated ParametricSpikyCircle", animated_vertical_segments, animated_rotation_segments),
+                                      ParametricSpikyCircle, animated_vertical_segments, animated_rotation_segments);
 
     
     
@@ -384,7 +2939,7 @@ int main(void)
     
     
 //scene 1
-GLuint program = CreateProgramFromSources(
+GLuint program = BeginProgramFromSources(
         R"VERTEX(
 #version 330 core
 
@@ -417,14 +2972,9 @@ void main()
    out_color = vec3(1, 1, 1);
 }
         )FRAGMENT");
-    if (program == NULL)
-    {
-        glfwTerminate();
-        return -1;
-    }
     
 //scene 2
-    GLuint program_6 = CreateProgramFromSources(
+    GLuint program_6 = BeginProgramFromSources(
             R"VERTEX(
     #version 330 core
 
@@ -463,11 +3013,6 @@ void main()
 
     }
             )FRAGMENT");
-        if (program_6 == NULL)
-        {
-            glfwTerminate();
-            return -1;
-        }
     
     
     
@@ -475,7 +3020,7 @@ void main()
     
     
 //scene 6
-GLuint program_1 = CreateProgramFromSources(
+GLuint program_1 = BeginProgramFromSources(
             R"VERTEX(
 #version 330 core
 
@@ -545,14 +3090,9 @@ void main()
   out_color = vec4(normalize(color), 1);
 }
     )FRAGMENT");
-        if (program_1 == NULL)
-        {
-            glfwTerminate();
-            return -1;
-        }
     
 //scene 3
-GLuint program_2 = CreateProgramFromSources(
+GLuint program_2 = BeginProgramFromSources(
           R"VERTEX(
 #version 330 core
 
@@ -606,14 +3146,9 @@ void main()
    out_color = vec4(color, 1);
 }
             )FRAGMENT");
-        if (program_2 == NULL)
-        {
-            glfwTerminate();
-            return -1;
-        }
 
 //scene 4
-GLuint program_3 = CreateProgramFromSources(
+GLuint program_3 = BeginProgramFromSources(
            R"VERTEX(
 #version 330 core
 
@@ -690,14 +3225,9 @@ void main()
    
 }
                 )FRAGMENT");
-            if (program_3 == NULL)
-            {
-                glfwTerminate();
-                return -1;
-            }
     
 //scene 5
-GLuint program_5 = CreateProgramFromSources(
+GLuint program_5 = BeginProgramFromSources(
               R"VERTEX(
     #version 330 core
 
@@ -754,294 +3284,606 @@ GLuint program_5 = CreateProgramFromSources(
        out_color = vec4(color, 1);
     }
                 )FRAGMENT");
-            if (program_5 == NULL)
-            {
-                glfwTerminate();
-                return -1;
-            }
 
     
     
-    auto u_transform_location = glGetUniformLocation(program, "u_transform");
-    auto u_transform_location_1 = glGetUniformLocation(program_1, "u_transform");
-    auto u_transform_location_2 = glGetUniformLocation(program_2, "u_transform");
-    auto u_transform_location_3 = glGetUniformLocation(program_3, "u_transform");
-    auto u_transform_location_5 = glGetUniformLocation(program_5, "u_transform");
-    auto u_transform_location_6 = glGetUniformLocation(program_6, "u_transform");
-    auto u_mouse_position_location_3 = glGetUniformLocation(program_3, "u_mouse_position");
-    auto u_mouse_position_location_1 = glGetUniformLocation(program_1, "u_mouse_position");
-    
-    auto color_location = glGetUniformLocation(program_3, "u_color");
-    auto color_location_5 = glGetUniformLocation(program_5, "u_color");
+    //looked up as each program finishes linking, -1 until then
+    GLint u_transform_location = -1, u_transform_location_1 = -1, u_transform_location_2 = -1;
+    GLint u_transform_location_3 = -1, u_transform_location_5 = -1, u_transform_location_6 = -1;
+    GLint u_mouse_position_location_3 = -1, u_mouse_position_location_1 = -1;
+    GLint color_location = -1, color_location_5 = -1;
+
+    auto LocateUniforms = [&](GLuint linked)
+    {
+        if (linked == program)
+            u_transform_location = glGetUniformLocation(program, "u_transform");
+        if (linked == program_1)
+        {
+            u_transform_location_1 = glGetUniformLocation(program_1, "u_transform");
+            u_mouse_position_location_1 = glGetUniformLocation(program_1, "u_mouse_position");
+        }
+        if (linked == program_2)
+            u_transform_location_2 = glGetUniformLocation(program_2, "u_transform");
+        if (linked == program_3)
+        {
+            u_transform_location_3 = glGetUniformLocation(program_3, "u_transform");
+            u_mouse_position_location_3 = glGetUniformLocation(program_3, "u_mouse_position");
+            color_location = glGetUniformLocation(program_3, "u_color");
+        }
+        if (linked == program_5)
+        {
+            u_transform_location_5 = glGetUniformLocation(program_5, "u_transform");
+            color_location_5 = glGetUniformLocation(program_5, "u_color");
+        }
+        if (linked == program_6)
+            u_transform_location_6 = glGetUniformLocation(program_6, "u_transform");
+    };
+
+    //the default scene's program first, it gates the first frame
+    std::vector<GLuint> pending_programs = { program, program_6, program_1, program_2, program_3, program_5 };
+    std::vector<GLuint> linked_programs;
      
     glm::vec3 chasing_pos = glm::vec3(0,0,0);
-    
-    /* Loop until the user closes the window */
-    while (!glfwWindowShouldClose(window))
+    //the time of the previous packet, the first one starts the chaser at rest. 0 is a valid time on the virtual clock
+    double chasing_time = 0;
+    bool chasing_started = false;
+
+    //casts the cursor ray at every mesh in the packet, while picking is on (P)
+    RayHit last_pick;
+    const PickingMesh* last_pick_mesh = NULL;
+    int pick_queries = 0;
+    double pick_seconds = 0;
+    double pick_max_seconds = 0;
+    double pick_report_time = 0;
+    auto PickUnderCursor = [&](const FramePacket& packet)
     {
-        glfwSetKeyCallback(window, key_callback);
-        
-        /* Render here */
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
+        auto start = Seconds();
+        RayHit closest;
+        //the cursor ray runs from the near to the far plane over [0, 1], the same for every mesh
+        closest.t = 1;
+        const PickingMesh* closest_mesh = NULL;
+        for (const auto& draw : packet.draws)
+        {
+            auto found = picking.find(draw.vao);
+            if (draw.vao == NULL || found == picking.end())
+                continue;
+            if (found->second.ticket < 0)
+                EnqueuePicking(found->second);
+            if (!builder.Finished(found->second.ticket))
+                continue;
+
+            glm::vec3 origin, direction;
+            CursorRay(draw.transform, packet.mouse_position, origin, direction);
+            auto hit = IntersectMeshBVH(found->second.bvh, origin, direction, closest.t);
+            if (hit.hit)
+            {
+                closest = hit;
+                closest_mesh = &found->second;
+            }
+        }
+
+        auto seconds = Seconds() - start;
+        ++pick_queries;
+        pick_seconds += seconds;
+        pick_max_seconds = std::max(pick_max_seconds, seconds);
+
+        if (closest_mesh != last_pick_mesh || closest.triangle != last_pick.triangle)
+        {
+            if (closest_mesh != NULL)
+                std::cout << "Pick: " << closest_mesh->name << " triangle " << closest.triangle
+                          << ", barycentric (" << closest.barycentric.x << ", " << closest.barycentric.y << ")"
+                          << ", normal (" << closest.normal.x << ", " << closest.normal.y << ", " << closest.normal.z << ")" << std::endl;
+            else
+                std::cout << "Pick: nothing" << std::endl;
+        }
+        last_pick = closest;
+        last_pick_mesh = closest_mesh;
+
+        if (packet.time - pick_report_time >= 1)
+        {
+            std::cout << "Picking: " << pick_queries << " queries, mean " << pick_seconds / pick_queries * 1e6
+                      << " us, max " << pick_max_seconds * 1e6 << " us" << std::endl;
+            pick_report_time = packet.time;
+            pick_queries = 0;
+            pick_seconds = 0;
+            pick_max_seconds = 0;
+        }
+    };
+
+    /* Scene logic, turns the global state into a frame packet */
+    auto BuildFramePacket = [&](FramePacket& packet)
+    {
+        packet.draws.clear();
+        packet.time = Globals.input.Time();
+        packet.screen_dimensions = Globals.screen_dimensions;
+        packet.scene = Globals.scene;
+        packet.capture = Globals.capture;
+        packet.gl_state_report = Globals.gl_state_report;
+        packet.dynamic_resolution = Globals.dynamic_resolution;
+        packet.unique_edges = Globals.unique_edges;
+
         // Change the position of a vertex dynamically
         auto mouse_position = Globals.mouse_position / glm::dvec2(Globals.screen_dimensions);
         mouse_position.y = 1. - mouse_position.y;
         mouse_position = mouse_position * 2. - 1.;
-        
+        packet.mouse_position = glm::vec2(mouse_position);
+
     if(Globals.scene == 0)
      {
-          glUseProgram(program);
-          glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                         
-          glm::mat4 transform(1.0);
-          transform = glm::scale(transform, glm::vec3(0.4));
-                     
-          transform       = glm::translate(transform,  glm::vec3(1.2,1.2,0));
-          auto transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
-          auto transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
-          auto transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
-                     
-          transform  = glm::rotate(transform,  glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-          transform2 = glm::rotate(transform2, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-          transform3 = glm::rotate(transform3, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-          transform4 = glm::rotate(transform4, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-                         
-          glBindVertexArray(shape_VAO.id);
-          glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform));
-          glDrawElements(GL_TRIANGLES, shape_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                                 
-          glBindVertexArray(shape1_VAO.id);
-          glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform2));
-          glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                                        
-          glBindVertexArray(shape3_VAO.id);
-          glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform3));
-          glDrawElements(GL_TRIANGLES, shape3_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                         
-          glBindVertexArray(shape2_VAO.id);
-          glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform4));
-          glDrawElements(GL_TRIANGLES, shape2_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
+          glm::mat4 transform, transform2, transform3, transform4;
+          GridTransforms(packet.time, transform, transform2, transform3, transform4);
+
+          packet.Draw(shape_VAO, program, GL_LINE, u_transform_location, transform);
+          packet.Draw(shape1_VAO, program, GL_LINE, u_transform_location, transform2);
+          packet.Draw(shape3_VAO, program, GL_LINE, u_transform_location, transform3);
+          packet.Draw(shape2_VAO, program, GL_LINE, u_transform_location, transform4);
      }
          
         
     if(Globals.scene == 1)
     {
-         glUseProgram(program);
-         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                        
-         glm::mat4 transform(1.0);
-         transform = glm::scale(transform, glm::vec3(0.4));
-                    
-         transform       = glm::translate(transform,  glm::vec3(1.2,1.2,0));
-         auto transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
-         auto transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
-         auto transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
-                    
-         transform  = glm::rotate(transform,  glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-         transform2 = glm::rotate(transform2, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-         transform3 = glm::rotate(transform3, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-         transform4 = glm::rotate(transform4, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-                        
-        
+         glm::mat4 transform, transform2, transform3, transform4;
+         GridTransforms(packet.time, transform, transform2, transform3, transform4);
+
          //shape - parametricCircle, shape1 - ParametricHalfCircle, 2 - ParametricSpikyCircle, 3 - ParametricSpikes
-        
-         glBindVertexArray(shape_VAO.id); //ParametricCirle //sağ üst
-         glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform));
-         glDrawElements(GL_TRIANGLES, shape_VAO.element_array_count, GL_UNSIGNED_INT, NULL); // Draw the triangle
-                                
-         glBindVertexArray(shape1_VAO.id); //ParametricHalfCircle //sol üst
-         glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform2));
-         glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-            
-         glBindVertexArray(shape3_VAO.id); //ParametricSpikes //sağ alt
-         glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform3));
-         glDrawElements(GL_TRIANGLES, shape3_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-          
-         glBindVertexArray(shape2_VAO.id); //ParametricSpikyCircle //sol alt
-         glUniformMatrix4fv(u_transform_location, 1, GL_FALSE, glm::value_ptr(transform4));
-         glDrawElements(GL_TRIANGLES, shape2_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-         
+         packet.Draw(shape_VAO, program, GL_LINE, u_transform_location, transform); //ParametricCirle //sağ üst
+         packet.Draw(shape1_VAO, program, GL_LINE, u_transform_location, transform2); //ParametricHalfCircle //sol üst
+         packet.Draw(shape3_VAO, program, GL_LINE, u_transform_location, transform3); //ParametricSpikes //sağ alt
+         packet.Draw(shape2_VAO, program, GL_LINE, u_transform_location, transform4); //ParametricSpikyCircle //sol alt
     }
         
         
     if(Globals.scene == 2)
     {
-        glUseProgram(program_6);
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-                       
-        glm::mat4 transform(1.0);
-        transform = glm::scale(transform, glm::vec3(0.4));
-                   
-        transform       = glm::translate(transform,  glm::vec3(1.2,1.2,0));
-        auto transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
-        auto transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
-        auto transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
-                   
-        transform  = glm::rotate(transform,  glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-        transform2 = glm::rotate(transform2, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-        transform3 = glm::rotate(transform3, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-        transform4 = glm::rotate(transform4, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-                       
-        glBindVertexArray(shape_VAO.id); //ParametricCirle
-        glUniformMatrix4fv(u_transform_location_6, 1, GL_FALSE, glm::value_ptr(transform));
-        glDrawElements(GL_TRIANGLES, shape_VAO.element_array_count, GL_UNSIGNED_INT, NULL); // Draw the triangle
-                               
-        glBindVertexArray(shape1_VAO.id); //ParametricHalfCircle
-        glUniformMatrix4fv(u_transform_location_6, 1, GL_FALSE, glm::value_ptr(transform2));
-        glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                                      
-        glBindVertexArray(shape3_VAO.id); //ParametricSpikes
-        glUniformMatrix4fv(u_transform_location_6, 1, GL_FALSE, glm::value_ptr(transform3));
-        glDrawElements(GL_TRIANGLES, shape3_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                       
-        glBindVertexArray(shape2_VAO.id); //ParametricSpikyCircle
-        glUniformMatrix4fv(u_transform_location_6, 1, GL_FALSE, glm::value_ptr(transform4));
-        glDrawElements(GL_TRIANGLES, shape2_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
+        glm::mat4 transform, transform2, transform3, transform4;
+        GridTransforms(packet.time, transform, transform2, transform3, transform4);
+
+        packet.Draw(shape_VAO, program_6, GL_FILL, u_transform_location_6, transform); //ParametricCirle
+        packet.Draw(shape1_VAO, program_6, GL_FILL, u_transform_location_6, transform2); //ParametricHalfCircle
+        packet.Draw(shape3_VAO, program_6, GL_FILL, u_transform_location_6, transform3); //ParametricSpikes
+        packet.Draw(shape2_VAO, program_6, GL_FILL, u_transform_location_6, transform4); //ParametricSpikyCircle
     }
         
             
     if(Globals.scene == 3)
     {
-        
-      glUseProgram(program_2);
-      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-                  
-      glm::mat4 transform(1.0);
-      transform = glm::scale(transform, glm::vec3(0.4));
-              
-      transform       = glm::translate(transform,  glm::vec3(1.2,1.2,0));
-      auto transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
-      auto transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
-      auto transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
-              
-      transform  = glm::rotate(transform,  glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform2 = glm::rotate(transform2, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform3 = glm::rotate(transform3, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform4 = glm::rotate(transform4, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-                  
-      glBindVertexArray(shape_VAO.id); //ParametricCirle
-      glUniformMatrix4fv(u_transform_location_2, 1, GL_FALSE, glm::value_ptr(transform));
-      glDrawElements(GL_TRIANGLES, shape_VAO.element_array_count, GL_UNSIGNED_INT, NULL); // Draw the triangle
-                          
-      glBindVertexArray(shape1_VAO.id); //ParametricHalfCircle
-      glUniformMatrix4fv(u_transform_location_2, 1, GL_FALSE, glm::value_ptr(transform2));
-      glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                                 
-      glBindVertexArray(shape3_VAO.id); //ParametricSpikes
-      glUniformMatrix4fv(u_transform_location_2, 1, GL_FALSE, glm::value_ptr(transform3));
-      glDrawElements(GL_TRIANGLES, shape3_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                  
-      glBindVertexArray(shape2_VAO.id); //ParametricSpikyCircle
-      glUniformMatrix4fv(u_transform_location_2, 1, GL_FALSE, glm::value_ptr(transform4));
-      glDrawElements(GL_TRIANGLES, shape2_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-        
+      glm::mat4 transform, transform2, transform3, transform4;
+      GridTransforms(packet.time, transform, transform2, transform3, transform4);
+
+      packet.Draw(shape_VAO, program_2, GL_FILL, u_transform_location_2, transform); //ParametricCirle
+      packet.Draw(shape1_VAO, program_2, GL_FILL, u_transform_location_2, transform2); //ParametricHalfCircle
+      packet.Draw(shape3_VAO, program_2, GL_FILL, u_transform_location_2, transform3); //ParametricSpikes
+      packet.Draw(shape2_VAO, program_2, GL_FILL, u_transform_location_2, transform4); //ParametricSpikyCircle
     }
             
     if(Globals.scene == 4)
     {
-        
-      glUseProgram(program_3);
-      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            
-      glUniform2fv(u_mouse_position_location_3, 1, glm::value_ptr(glm::vec2(mouse_position)));
-            
-      glm::mat4 transform(1.0);
-      transform = glm::scale(transform, glm::vec3(0.4));
-        
-      transform       = glm::translate(transform,  glm::vec3(1.2,1.2,0));
-      auto transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
-      auto transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
-      auto transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
-        
-      transform  = glm::rotate(transform,  glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform2 = glm::rotate(transform2, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform3 = glm::rotate(transform3, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-      transform4 = glm::rotate(transform4, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-            
-      glBindVertexArray(shape_VAO.id); //ParametricCirle
-      glUniformMatrix4fv(u_transform_location_3, 1, GL_FALSE, glm::value_ptr(transform));
-      glUniform3fv(color_location, 1, glm::value_ptr(glm::vec3(1,0,0)));
-      glDrawElements(GL_TRIANGLES, shape_VAO.element_array_count, GL_UNSIGNED_INT, NULL); // Draw the triangle
-                    
-      glBindVertexArray(shape1_VAO.id); //ParametricHalfCircle
-      glUniformMatrix4fv(u_transform_location_3, 1, GL_FALSE, glm::value_ptr(transform2));
-      glUniform3fv(color_location, 1, glm::value_ptr(glm::vec3(0.5,0.5,0.5)));
-      glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                           
-      glBindVertexArray(shape3_VAO.id); //ParametricSpikes
-      glUniformMatrix4fv(u_transform_location_3, 1, GL_FALSE, glm::value_ptr(transform3));
-      glUniform3fv(color_location, 1, glm::value_ptr(glm::vec3(0,0,1)));
-      glDrawElements(GL_TRIANGLES, shape3_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-            
-      glBindVertexArray(shape2_VAO.id); //ParametricSpikyCircle
-      glUniformMatrix4fv(u_transform_location_3, 1, GL_FALSE, glm::value_ptr(transform4));
-      glUniform3fv(color_location, 1, glm::value_ptr(glm::vec3(0,1,0)));
-      glDrawElements(GL_TRIANGLES, shape2_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-
+      glm::mat4 transform, transform2, transform3, transform4;
+      GridTransforms(packet.time, transform, transform2, transform3, transform4);
+
+      packet.Draw(shape_VAO, program_3, GL_FILL, u_transform_location_3, transform, //ParametricCirle
+                  color_location, glm::vec3(1,0,0), u_mouse_position_location_3);
+      packet.Draw(shape1_VAO, program_3, GL_FILL, u_transform_location_3, transform2, //ParametricHalfCircle
+                  color_location, glm::vec3(0.5,0.5,0.5), u_mouse_position_location_3);
+      packet.Draw(shape3_VAO, program_3, GL_FILL, u_transform_location_3, transform3, //ParametricSpikes
+                  color_location, glm::vec3(0,0,1), u_mouse_position_location_3);
+      packet.Draw(shape2_VAO, program_3, GL_FILL, u_transform_location_3, transform4, //ParametricSpikyCircle
+                  color_location, glm::vec3(0,1,0), u_mouse_position_location_3);
     }
         
+    if (!chasing_started)
+    {
+        chasing_time = packet.time;
+        chasing_started = true;
+    }
+
     if(Globals.scene == 5)
     {
-        glUseProgram(program_5);
-        
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        glBindVertexArray(shape1_VAO.id);
-            
         auto scale = glm::scale(glm::vec3(0.3));
         auto translate = glm::translate(glm::vec3(mouse_position.x, mouse_position.y,0));
         auto transform = translate * scale;
         
         glm::mat4 chasing_transform(1.0);
-               
+
+        //0.99 per frame at 60 FPS, so the chaser keeps its speed when packets come at another rate
         glm::vec3 mouse_pos = glm::vec3(mouse_position.x, mouse_position.y, 0);
-        chasing_pos = glm::mix(mouse_pos, chasing_pos, 0.99);
+        auto elapsed = packet.time - chasing_time;
+        chasing_pos = glm::mix(mouse_pos, chasing_pos, float(pow(0.99, elapsed * 60)));
         auto chasing_translate = glm::translate(chasing_pos);
         chasing_transform = chasing_translate * scale;
+
+        packet.Draw(shape1_VAO, program_5, GL_FILL, u_transform_location_5, chasing_transform,
+                    color_location_5, glm::vec3(0.5,0.5,0.5));
+
+        auto color = glm::distance(chasing_pos, mouse_pos) > 0.6 ? glm::vec3(0,1,0) : glm::vec3(1,0,0);
+        packet.Draw(shape1_VAO, program_5, GL_FILL, u_transform_location_5, transform, color_location_5, color);
+    }
+    chasing_time = packet.time;
         
-        glUniformMatrix4fv(u_transform_location_5, 1, GL_FALSE, glm::value_ptr(chasing_transform));
-        glUniform3fv(color_location_5, 1, glm::value_ptr(glm::vec3(0.5,0.5,0.5)));
-        glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-        
-        glUniformMatrix4fv(u_transform_location_5, 1, GL_FALSE, glm::value_ptr(transform));
-        if(glm::distance(chasing_pos, mouse_pos) > 0.6)
+    if(Globals.scene == 6)
+    {
+         glm::mat4 transform(1.0);
+         transform = glm::scale(transform, glm::vec3(0.6));
+         transform = glm::rotate(transform, glm::radians(float(packet.time * 10)), glm::vec3(1, 1, 0));
+
+         auto& sixth_mesh = Globals.adaptive_mesh && adaptive_sixth_VAO != NULL ? *adaptive_sixth_VAO : sixth_VAO;
+         packet.Draw(sixth_mesh, program_1, GL_FILL, u_transform_location_1, transform, //ParametricCirle
+                     -1, glm::vec3(), u_mouse_position_location_1);
+    }
+
+    if(Globals.scene == 7)
+    {
+         glm::mat4 transform(1.0);
+         transform = glm::scale(transform, glm::vec3(0.6));
+         transform = glm::rotate(transform, glm::radians(float(packet.time * 10)), glm::vec3(1, 1, 0));
+
+         packet.Draw(animated_surface, program_1, GL_FILL, u_transform_location_1, transform, //ParametricSpikyCircle, deforming
+                     -1, glm::vec3(), u_mouse_position_location_1);
+    }
+
+    if (Globals.picking)
+        PickUnderCursor(packet);
+    else
+        ReleasePicking();
+    };
+
+    /* GL submission, runs wherever the context is current */
+    glm::ivec2 viewport = Globals.screen_dimensions;
+    std::unique_ptr<FrameCapture> capture;
+    auto StopCapture = [&]()
+    {
+        capture->Stop();
+        capture.reset();
+    };
+    std::unique_ptr<DynamicResolution> dynamic_resolution;
+    GpuTimer wireframe_timer;
+
+    int gl_state_scene = Globals.scene;
+    double gl_state_report_time = 0;
+
+    //returns how many draws were skipped because their program or mesh is still being built
+    auto SubmitFramePacket = [&](const FramePacket& packet)
+    {
+        int skipped = 0;
+        if (packet.screen_dimensions != viewport)
         {
-            glUniform3fv(color_location_5, 1, glm::value_ptr(glm::vec3(0,1,0)));
+            viewport = packet.screen_dimensions;
+            glViewport(0, 0, viewport.x, viewport.y);
         }
-        
-        else
+
+        if (packet.dynamic_resolution && dynamic_resolution == NULL)
+            dynamic_resolution.reset(new DynamicResolution(Globals.frame_budget_ms / 1000, Globals.resolution_log_path));
+        if (!packet.dynamic_resolution && dynamic_resolution != NULL)
+            dynamic_resolution.reset();
+        if (dynamic_resolution != NULL)
+            dynamic_resolution->Begin(viewport);
+
+        /* Render here */
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        bool wireframe_scene = packet.scene == 0 || packet.scene == 1;
+        long long wireframe_lines = 0;
+        if (wireframe_scene)
+            wireframe_timer.Begin();
+
+        for (const auto& draw : packet.draws)
+        {
+            if (std::find(linked_programs.begin(), linked_programs.end(), draw.program) == linked_programs.end() ||
+                (draw.vao != NULL && !draw.vao->ready))
+            {
+                ++skipped;
+                continue;
+            }
+
+            //GL_LINES ignore the polygon mode, it is left as it is
+            bool edges = draw.polygon_mode == GL_LINE && packet.unique_edges && draw.vao != NULL && draw.vao->edge_array_count > 0;
+            gl_state.UseProgram(draw.program);
+            if (!edges)
+                gl_state.PolygonMode(draw.polygon_mode);
+
+            gl_state.Uniform(draw.mouse_position_location, packet.mouse_position);
+            gl_state.Uniform(draw.transform_location, draw.transform);
+            gl_state.Uniform(draw.color_location, draw.color);
+
+            if (draw.surface != NULL)
+            {
+                draw.surface->Update(workers, packet.time);
+                gl_state.BindVertexArray(draw.surface->id);
+                draw.surface->Draw();
+                draw.surface->Report(packet.time);
+                continue;
+            }
+
+            if (edges)
+            {
+                gl_state.BindVertexArray(draw.vao->edge_id);
+                glDrawElements(GL_LINES, draw.vao->edge_array_count, GL_UNSIGNED_INT, NULL);
+                wireframe_lines += draw.vao->edge_array_count / 2;
+                continue;
+            }
+
+            gl_state.BindVertexArray(draw.vao->id);
+            glDrawElements(GL_TRIANGLES, draw.vao->element_array_count, GL_UNSIGNED_INT, NULL);
+            if (draw.polygon_mode == GL_LINE)
+                wireframe_lines += draw.vao->element_array_count;
+        }
+
+        if (wireframe_scene)
+        {
+            wireframe_timer.End();
+            wireframe_timer.Report(Seconds(), "Wireframe scene " + std::to_string(packet.scene) +
+                                   (packet.unique_edges ? ", unique edges (L)" : ", GL_LINE polygon mode (L)"), wireframe_lines);
+        }
+
+        //captures see the upscaled frame
+        if (dynamic_resolution != NULL)
+            dynamic_resolution->End(viewport);
+
+        if (packet.capture && capture == NULL)
+            capture.reset(new FrameCapture(Globals.capture_path));
+        if (!packet.capture && capture != NULL)
+            StopCapture();
+        if (capture != NULL)
+            capture->ReadFrame(viewport);
+
+        //dumped for each scene when it is left, and once per second while G is on
+        gl_state.Frame();
+        if (packet.scene != gl_state_scene)
+        {
+            gl_state.Report("scene " + std::to_string(gl_state_scene));
+            gl_state_scene = packet.scene;
+            gl_state_report_time = packet.time;
+        }
+        else if (packet.gl_state_report && packet.time - gl_state_report_time >= 1)
+        {
+            gl_state.Report("scene " + std::to_string(packet.scene) + " live");
+            gl_state_report_time = packet.time;
+        }
+        return skipped;
+    };
+
+    /* Frames past startup, the ones the virtual clock of a recording or a replay counts */
+    auto BuildNextFramePacket = [&](FramePacket& packet)
+    {
+        //replayed input goes through the same callbacks as live input, before the packet of its frame
+        Globals.input.feeding = true;
+        while (auto event = Globals.input.Next())
+        {
+            if (event->type == InputSession::cursor_event)
+                CursorPositionCallback(window, event->x, event->y);
+            else if (event->type == InputSession::key_event)
+                key_callback(window, event->key, 0, event->action, event->mods);
+            else if (event->type == InputSession::resize_event)
+            {
+                glfwSetWindowSize(window, event->width, event->height);
+                WindowSizeCallback(window, event->width, event->height);
+            }
+        }
+        Globals.input.feeding = false;
+
+        BuildFramePacket(packet);
+        Globals.input.Advance();
+        if (Globals.input.Finished())
+            glfwSetWindowShouldClose(window, GL_TRUE);
+    };
+
+    /* Startup, frames are presented as soon as the default scene has what it needs, the rest finishes meanwhile */
+    {
+        FramePacket packet;
+        bool first_frame = false;
+        //the baked meshes are complete from the start
+        std::vector<VAO*> building = { &shape2_VAO, &sixth_VAO };
+
+        while (!glfwWindowShouldClose(window) && (!pending_programs.empty() || !building.empty() || adaptive_sixth_VAO == NULL))
+        {
+            for (size_t i = 0; i < building.size();)
+            {
+                if (builder.Finished(building[i]->build_ticket))
+                {
+                    building[i]->FinishBuild();
+                    building.erase(building.begin() + i);
+                }
+                else
+                    ++i;
+            }
+
+            if (adaptive_sixth_VAO == NULL && builder.Finished(adaptive_ticket))
+            {
+                adaptive_sixth_VAO.reset(new VAO(GridName("ParametricSpikyCircle adaptive", int(adaptive_samples.size()), adaptive_rotation_segments),
+                                                 ParametricSpikyCircle, adaptive_samples, adaptive_rotation_segments, &builder));
+                gl_state.Invalidate();
+                RegisterPicking(*adaptive_sixth_VAO);
+                building.push_back(adaptive_sixth_VAO.get());
+            }
+
+            //without the extension there is no telling which program is done, so take them one per frame in order
+            for (size_t i = 0; i < pending_programs.size();)
+            {
+                if (!ProgramCompletionReady(pending_programs[i]))
+                {
+                    ++i;
+                    continue;
+                }
+
+                if (FinishProgram(pending_programs[i]) == 0)
+                {
+                    //their destructors call GL, which has to happen before the context goes
+                    if (capture != NULL)
+                        StopCapture();
+                    dynamic_resolution.reset();
+                    builder.Stop();
+                    glfwTerminate();
+                    return -1;
+                }
+                LocateUniforms(pending_programs[i]);
+                linked_programs.push_back(pending_programs[i]);
+                pending_programs.erase(pending_programs.begin() + i);
+
+                if (!Globals.parallel_shader_compile)
+                    break;
+            }
+
+            BuildFramePacket(packet);
+            auto complete = SubmitFramePacket(packet) == 0;
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+
+            if (complete && !first_frame)
+            {
+                first_frame = true;
+                std::cout << "First complete frame after " << (Seconds() - startup_start) * 1000 << " ms" << std::endl;
+            }
+        }
+
+        //unless the window was closed before that
+        if (!glfwWindowShouldClose(window))
         {
-            glUniform3fv(color_location_5, 1, glm::value_ptr(glm::vec3(1,0,0)));
+            std::cout << "All meshes and programs ready after " << (Seconds() - startup_start) * 1000 << " ms" << std::endl;
+            //sixth_error is measured on ParametricSpikyCircle, which --curve replaces in the uniform mesh only
+            if (Globals.curve_source.empty())
+                std::cout << "Scene 6 uniform mesh: " << sixth_VAO.element_array_count / 3 << " triangles, error " << sixth_error << std::endl;
+            else
+                std::cout << "Scene 6 uniform mesh: " << sixth_VAO.element_array_count / 3 << " triangles from --curve" << std::endl;
+            if (adaptive_sixth_VAO != NULL)
+                std::cout << "Scene 6 adaptive mesh (A): " << adaptive_sixth_VAO->element_array_count / 3 << " triangles, error "
+                          << SampledSurfaceError(ParametricSpikyCircle, adaptive_samples, adaptive_rotation_segments) << std::endl;
+            std::cout << "RSS after meshes: " << CurrentResidentBytes() / (1024 * 1024) << " MB, peak "
+                      << PeakResidentBytes() / (1024 * 1024) << " MB" << std::endl;
+            Globals.memory.Report("startup");
         }
-        glDrawElements(GL_TRIANGLES, shape1_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-       
     }
-        
-    if(Globals.scene == 6)
+
+    //a resize during startup was dropped above, it becomes the first event of the recording instead
+    Globals.input.Start();
     {
-         glUseProgram(program_1);
-        
-         glUniform2fv(u_mouse_position_location_1, 1, glm::value_ptr(glm::vec2(mouse_position)));
-                      
-         glm::mat4 transform(1.0);
-         transform = glm::scale(transform, glm::vec3(0.6));
-         transform = glm::rotate(transform, glm::radians(float(glfwGetTime() * 10)), glm::vec3(1, 1, 0));
-                                     
-         glUniformMatrix4fv(u_transform_location_1, 1, GL_FALSE, glm::value_ptr(transform));
-         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            
-         glBindVertexArray(sixth_VAO.id); //ParametricCirle
-         glDrawElements(GL_TRIANGLES, sixth_VAO.element_array_count, GL_UNSIGNED_INT, NULL);
-        
+        int width = 0, height = 0;
+        glfwGetWindowSize(window, &width, &height);
+        if (glm::ivec2(width, height) != Globals.screen_dimensions)
+            WindowSizeCallback(window, width, height);
     }
-        
-        /* Swap front and back buffers */
-        glfwSwapBuffers(window);
 
-        /* Poll for and process events */
-        glfwPollEvents();
+    if (!Globals.render_thread)
+    {
+        FrameTimings timings("single thread", { "build", "submit", "swap", "poll" });
+        FramePacket packet;
+
+        std::ofstream frame_log;
+        if (!Globals.frame_log_path.empty())
+        {
+            frame_log.open(Globals.frame_log_path);
+            if (!frame_log)
+                std::cout << "Error: Could not open " << Globals.frame_log_path << std::endl;
+            frame_log << "frame,time,build_ms,submit_ms,swap_ms,poll_ms\n" << std::fixed << std::setprecision(4);
+        }
+        int frame = 0;
+
+        /* Loop until the user closes the window */
+        while (!glfwWindowShouldClose(window))
+        {
+            auto start = Seconds();
+            BuildNextFramePacket(packet);
+            auto built = Seconds();
+            SubmitFramePacket(packet);
+            auto submitted = Seconds();
+
+            /* Swap front and back buffers */
+            glfwSwapBuffers(window);
+            auto swapped = Seconds();
+
+            /* Poll for and process events */
+            glfwPollEvents();
+            auto polled = Seconds();
+
+            timings.Phase(0, built - start);
+            timings.Phase(1, submitted - built);
+            timings.Phase(2, swapped - submitted);
+            timings.Phase(3, polled - swapped);
+            timings.Frame(polled);
+
+            if (frame_log.is_open())
+                frame_log << frame << "," << packet.time << "," << (built - start) * 1000 << "," << (submitted - built) * 1000
+                          << "," << (swapped - submitted) * 1000 << "," << (polled - swapped) * 1000 << "\n";
+            ++frame;
+        }
+
+        if (frame_log.is_open())
+        {
+            frame_log.close();
+            if (!Globals.frame_log_baseline_path.empty())
+                CompareFrameLogs(Globals.frame_log_path, Globals.frame_log_baseline_path);
+        }
+
+        if (capture != NULL)
+            StopCapture();
+        dynamic_resolution.reset();
+    }
+    else
+    {
+        TripleBuffer<FramePacket> packets;
+        std::atomic<bool> quit(false);
+
+        //the render thread owns the context from here on
+        glfwMakeContextCurrent(NULL);
+        std::thread render_thread([&]()
+        {
+            glfwMakeContextCurrent(window);
+            FrameTimings timings("render thread", { "submit", "swap" });
+
+            while (!quit)
+            {
+                if (!packets.Acquire())
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+
+                auto start = Seconds();
+                SubmitFramePacket(packets.Front());
+                auto submitted = Seconds();
+
+                /* Swap front and back buffers */
+                glfwSwapBuffers(window);
+                auto swapped = Seconds();
+
+                timings.Phase(0, submitted - start);
+                timings.Phase(1, swapped - submitted);
+                timings.Frame(swapped);
+            }
+
+            if (capture != NULL)
+                StopCapture();
+            dynamic_resolution.reset();
+            glfwMakeContextCurrent(NULL);
+        });
+
+        FrameTimings timings("main thread", { "poll", "build" });
+        while (!glfwWindowShouldClose(window))
+        {
+            /* Poll for and process events */
+            auto start = Seconds();
+            glfwWaitEventsTimeout(0.001);
+            auto polled = Seconds();
+            timings.Phase(0, polled - start);
+
+            //build the next packet as soon as the renderer took the previous one, so it is fresh but never late
+            if (packets.Pending())
+                continue;
+
+            BuildNextFramePacket(packets.Back());
+            packets.Publish();
+
+            auto built = Seconds();
+            timings.Phase(1, built - polled);
+            timings.Frame(built);
+        }
+
+        quit = true;
+        render_thread.join();
+        glfwMakeContextCurrent(window);
     }
 
+    Globals.input.Stop();
+    builder.Stop();
     glfwTerminate();
     return 0;
 }
@@ -0,0 +1,492 @@
+#pragma once
+/* CPU side geometry, shared by the viewer and the benchmarks. Needs no OpenGL context */
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "GLM/glm.hpp"
+#include "GLM/gtc/constants.hpp"
+#include "GLM/gtx/rotate_vector.hpp"
+#include "glad.h"
+
+/* Profile Curves */
+inline glm::dvec2 ParametricHalfCircle(double t)
+{
+    // [0, 1]
+    t -= 0.5;
+    // [-0.5, 0.5]
+    t *= glm::pi<double>();
+    // [-PI*0.5, PI*0.5]
+    return glm::dvec2(cos(t), sin(t));
+}
+
+inline glm::dvec2 ParametricCircle(double t)
+{
+    // [0, 1]
+    //t -= 0.5;
+    // [-0.5, 0.5]
+    t *= glm::two_pi<double>();
+    // [-PI, PI]
+
+    //glm::dvec2 c(0.5, 0);
+    auto c = glm::dvec2(0.7, 0);
+    double r = 0.25;
+
+    return glm::dvec2(cos(t), sin(t)) * r + c;
+}
+
+inline glm::dvec2 ParametricSpikes(double t)
+{
+    // [0, 1]
+    t -= 0.5;
+    // [-0.5, 0.5]
+    t *= glm::two_pi<double>();
+    // [-PI, PI]
+
+    auto c = glm::dvec2(0.7, 0);
+    double r = 0.25;
+
+    int a = 2 + 4 * 4;
+    return (glm::dvec2(cos(t) + sin(a*t) / a, sin(t) + cos(a*t) / a) / 2.) * r + c;
+}
+
+inline glm::dvec2 ParametricSpikyCircle(double t)
+{
+      // [0, 1]
+      t *= glm::two_pi<double>();
+      // [0, 2*PI]
+
+      glm::dvec2 c(0.6, 0);
+      double r = 0.35;
+      int a = 1 + 2 * 6;
+
+      return glm::dvec2(cos(t) + sin(a*t) / a, sin(t) + cos(a*t) / a) * r + c;
+}
+
+static const struct {
+    const char* name;
+    glm::dvec2(*parametric_line)(double);
+} ParametricCurves[] = {
+    { "halfcircle", ParametricHalfCircle },
+    { "circle", ParametricCircle },
+    { "spikes", ParametricSpikes },
+    { "spikycircle", ParametricSpikyCircle },
+};
+
+inline glm::dvec3 ParametricSurface(glm::dvec2(*parametric_line)(double), double t, double r)
+{
+    auto p = glm::dvec3(parametric_line(t), 0);
+
+    //auto s = sin(r * glm::two_pi<double>() * 6) / 2 + 1;
+    //qp *= s * 0.3; //makes bigger
+    //p.y *= sin(r * glm::two_pi<double>() * 3) / 2 + 1;
+    return glm::rotateY(p, r * glm::two_pi<double>());
+}
+
+/* Generators. Each one writes rows [r_begin, r_end) of the grid into memory that already has room for the
+   whole grid, which can be a mapped OpenGL buffer, so disjoint rows can also be filled from several threads */
+inline void GenerateGridIndices(GLuint* indices, int vertical_segments, int rotation_segments, int r_begin, int r_end)
+{
+    auto VRtoIndex = [vertical_segments, rotation_segments](int v, int r) //2D to 1D map
+    {
+        return (r % rotation_segments) * vertical_segments + v;
+    };
+    indices += size_t(r_begin) * (vertical_segments - 1) * 6;
+    for (int r = r_begin; r < r_end; ++r)
+        for (int v = 0; v < vertical_segments-1; ++v)
+        {
+            *indices++ = VRtoIndex(v + 1, r);
+            *indices++ = VRtoIndex(v, r + 1);
+            *indices++ = VRtoIndex(v, r);
+
+            *indices++ = VRtoIndex(v + 1, r);
+            *indices++ = VRtoIndex(v + 1, r + 1);
+            *indices++ = VRtoIndex(v, r + 1);
+        }
+}
+
+//the same grid as GL_LINES pairs, each edge once: per quad the v-line, the r-line and the diagonal the two
+//triangles share, 3 * vertical_segments - 2 edges per row. The triangle list drawn in GL_LINE polygon mode
+//rasterizes every interior edge twice
+inline void GenerateGridEdges(GLuint* edges, int vertical_segments, int rotation_segments, int r_begin, int r_end)
+{
+    auto VRtoIndex = [vertical_segments, rotation_segments](int v, int r) //2D to 1D map
+    {
+        return (r % rotation_segments) * vertical_segments + v;
+    };
+    edges += size_t(r_begin) * (3 * vertical_segments - 2) * 2;
+    for (int r = r_begin; r < r_end; ++r)
+        for (int v = 0; v < vertical_segments; ++v)
+        {
+            *edges++ = VRtoIndex(v, r);
+            *edges++ = VRtoIndex(v, r + 1);
+
+            if (v == vertical_segments - 1)
+                continue;
+
+            *edges++ = VRtoIndex(v, r);
+            *edges++ = VRtoIndex(v + 1, r);
+
+            *edges++ = VRtoIndex(v + 1, r);
+            *edges++ = VRtoIndex(v, r + 1);
+        }
+}
+
+inline void GenerateParametricPositions(
+    glm::vec3* positions,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments,
+    int r_begin,
+    int r_end
+)
+{
+    auto parametric_surface = [parametric_line](double t, double r)
+    {
+        return ParametricSurface(parametric_line, t, r);
+    };
+
+    //vertices are calculated by this resolution
+    positions += size_t(r_begin) * vertical_segments;
+    for (int r = r_begin; r < r_end; ++r)
+        for (int v = 0; v < vertical_segments; ++v)
+            *positions++ = parametric_surface(v / double(vertical_segments - 1), r / double(rotation_segments));
+}
+
+inline void GenerateParametricNormals(
+    glm::vec3* normals,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments,
+    int r_begin,
+    int r_end
+)
+{
+    auto parametric_surface = [parametric_line](double t, double r)
+    {
+        return ParametricSurface(parametric_line, t, r);
+    };
+
+    normals += size_t(r_begin) * vertical_segments;
+    for (int r = r_begin; r < r_end; ++r)
+        for (int v = 0; v < vertical_segments; ++v)
+        {
+            auto nv = v / double(vertical_segments - 1);
+            auto nr = r / double(rotation_segments);
+            
+            auto epsilonv = 1 / double(vertical_segments - 1);
+            auto epsilonr = 1 / double(rotation_segments);
+            
+            auto to_next_v = parametric_surface(nv + epsilonv, nr) - parametric_surface(nv, nr);
+            auto from_prev_v = parametric_surface(nv, nr) - parametric_surface(nv - epsilonv, nr);
+            auto tangent_v = (to_next_v + from_prev_v) / 2.; //take average
+
+            auto to_next_r = parametric_surface(nv, nr + epsilonr) - parametric_surface(nv, nr);
+            auto from_prev_r = parametric_surface(nv, nr) - parametric_surface(nv, nr - epsilonr);
+            auto tangent_r = (to_next_r + from_prev_r) / 2.; //take average
+                      
+            auto normal = glm::normalize(glm::cross(tangent_r, tangent_v));
+            *normals++ = normal;
+        }
+}
+
+/* std::vector versions, appending the whole grid */
+inline void GenerateGridIndices(std::vector<GLuint>& indices, int vertical_segments, int rotation_segments)
+{
+    auto offset = indices.size();
+    indices.resize(offset + size_t(rotation_segments) * (vertical_segments - 1) * 6);
+    GenerateGridIndices(indices.data() + offset, vertical_segments, rotation_segments, 0, rotation_segments);
+}
+
+inline void GenerateGridEdges(std::vector<GLuint>& edges, int vertical_segments, int rotation_segments)
+{
+    auto offset = edges.size();
+    edges.resize(offset + size_t(rotation_segments) * (3 * vertical_segments - 2) * 2);
+    GenerateGridEdges(edges.data() + offset, vertical_segments, rotation_segments, 0, rotation_segments);
+}
+
+inline void GenerateParametricPositions(
+    std::vector<glm::vec3>& positions,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments
+)
+{
+    auto offset = positions.size();
+    positions.resize(offset + size_t(vertical_segments) * rotation_segments);
+    GenerateParametricPositions(positions.data() + offset, parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+}
+
+inline void GenerateParametricNormals(
+    std::vector<glm::vec3>& normals,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments
+)
+{
+    auto offset = normals.size();
+    normals.resize(offset + size_t(vertical_segments) * rotation_segments);
+    GenerateParametricNormals(normals.data() + offset, parametric_line, vertical_segments, rotation_segments, 0, rotation_segments);
+}
+
+inline void GenerateParametricShape(
+    std::vector<glm::vec3>& positions,
+    std::vector<glm::vec3>& normals,
+    std::vector<GLuint>& indices,
+    glm::dvec2(*parametric_line)(double),
+    int vertical_segments,
+    int rotation_segments
+)
+{
+    GenerateParametricPositions(positions, parametric_line, vertical_segments, rotation_segments);
+    GenerateParametricNormals(normals, parametric_line, vertical_segments, rotation_segments);
+    GenerateGridIndices(indices, vertical_segments, rotation_segments);
+}
+
+/* Adaptive Sampling */
+//distance from p to the segment a-b
+inline double SegmentDistance(glm::dvec2 p, glm::dvec2 a, glm::dvec2 b)
+{
+    auto ab = b - a;
+    auto length_squared = glm::dot(ab, ab);
+    auto h = length_squared > 0 ? glm::clamp(glm::dot(p - a, ab) / length_squared, 0., 1.) : 0.;
+    return glm::length(p - (a + ab * h));
+}
+
+//splits [t0, t1] until the curve stays within chord_tolerance of the chord and turns less than angle_tolerance radians
+inline void SubdivideProfile(
+    std::vector<double>& profile_samples,
+    glm::dvec2(*parametric_line)(double),
+    double t0, glm::dvec2 p0,
+    double t1, glm::dvec2 p1,
+    double chord_tolerance,
+    double angle_tolerance,
+    int depth
+)
+{
+    auto tm = (t0 + t1) / 2;
+    auto pm = parametric_line(tm);
+
+    //the quarter points catch bumps that are symmetric around the middle
+    auto chord_error = std::max(SegmentDistance(pm, p0, p1), std::max(
+        SegmentDistance(parametric_line((t0 + tm) / 2), p0, p1),
+        SegmentDistance(parametric_line((tm + t1) / 2), p0, p1)
+    ));
+
+    //cusps turn by half a circle at any scale, so segments shorter than a few tolerances ignore the angle
+    auto d0 = pm - p0;
+    auto d1 = p1 - pm;
+    auto lengths = glm::length(d0) * glm::length(d1);
+    auto turn = lengths > 0 ? acos(glm::clamp(glm::dot(d0, d1) / lengths, -1., 1.)) : 0.;
+    if (glm::length(p1 - p0) < chord_tolerance * 16)
+        turn = 0;
+
+    if (depth == 0 || (chord_error <= chord_tolerance && turn <= angle_tolerance))
+    {
+        profile_samples.push_back(t1);
+        return;
+    }
+
+    //chord error shrinks with the square of the segment length, so split into as many pieces as that predicts
+    //instead of halving, which would overshoot the tolerance by up to a factor of two in sample count
+    auto pieces = std::max(2., std::max(ceil(sqrt(chord_error / chord_tolerance)), ceil(turn / angle_tolerance)));
+    pieces = std::min(pieces, 16.);
+
+    auto a = t0;
+    auto pa = p0;
+    for (int i = 1; i <= int(pieces); ++i)
+    {
+        auto b = i == int(pieces) ? t1 : t0 + (t1 - t0) * i / pieces;
+        auto pb = i == int(pieces) ? p1 : parametric_line(b);
+        SubdivideProfile(profile_samples, parametric_line, a, pa, b, pb, chord_tolerance, angle_tolerance, depth - 1);
+        a = b;
+        pa = pb;
+    }
+}
+
+//non-uniform t values in [0, 1], dense where the profile bends and sparse where it is flat
+inline std::vector<double> AdaptiveProfileSamples(
+    glm::dvec2(*parametric_line)(double),
+    double chord_tolerance,
+    double angle_tolerance,
+    int initial_segments = 32,
+    int max_depth = 8
+)
+{
+    std::vector<double> profile_samples(1, 0.);
+    for (int i = 0; i < initial_segments; ++i)
+    {
+        auto t0 = i / double(initial_segments);
+        auto t1 = (i + 1) / double(initial_segments);
+        SubdivideProfile(profile_samples, parametric_line, t0, parametric_line(t0), t1, parametric_line(t1), chord_tolerance, angle_tolerance, max_depth);
+    }
+    return profile_samples;
+}
+
+//largest distance of the profile from the rotation axis
+inline double ProfileRadius(glm::dvec2(*parametric_line)(double), const std::vector<double>& profile_samples)
+{
+    double radius = 0;
+    for (auto t : profile_samples)
+        radius = std::max(radius, std::abs(parametric_line(t).x));
+    return radius;
+}
+
+//fewest rotation segments whose sagitta at the widest radius stays within chord_tolerance
+inline int AdaptiveRotationSegments(double radius, double chord_tolerance, double angle_tolerance)
+{
+    auto segments = 2 * glm::pi<double>() / angle_tolerance;
+    if (radius > chord_tolerance)
+        segments = std::max(segments, glm::pi<double>() / acos(1 - chord_tolerance / radius));
+    return std::max(3, int(ceil(segments)));
+}
+
+//upper bound of the Hausdorff distance between the surface and its mesh: every dense sample of the profile is
+//measured against the polyline segment it falls into, plus the sagitta of the rotation segments
+inline double SampledSurfaceError(
+    glm::dvec2(*parametric_line)(double),
+    const std::vector<double>& profile_samples,
+    int rotation_segments,
+    int dense_samples = 1 << 16
+)
+{
+    double profile_error = 0;
+    size_t segment = 0;
+    auto a = parametric_line(profile_samples[0]);
+    auto b = parametric_line(profile_samples[1]);
+    for (int i = 0; i <= dense_samples; ++i)
+    {
+        auto t = i / double(dense_samples);
+        while (segment + 2 < profile_samples.size() && t > profile_samples[segment + 1])
+        {
+            ++segment;
+            a = b;
+            b = parametric_line(profile_samples[segment + 1]);
+        }
+        profile_error = std::max(profile_error, SegmentDistance(parametric_line(t), a, b));
+    }
+
+    auto radius = ProfileRadius(parametric_line, profile_samples);
+    return profile_error + radius * (1 - cos(glm::pi<double>() / rotation_segments));
+}
+
+inline std::vector<double> UniformProfileSamples(int vertical_segments)
+{
+    std::vector<double> profile_samples(vertical_segments);
+    for (int v = 0; v < vertical_segments; ++v)
+        profile_samples[v] = v / double(vertical_segments - 1);
+    return profile_samples;
+}
+
+//profile samples and rotation segments with the fewest triangles whose SampledSurfaceError stays within tolerance,
+//trying a few ways of splitting the error between the profile and the rotation. The tolerances handed down are
+//estimates, so every candidate is measured and tightened until it holds. The uniform grid the tolerance was taken
+//from is the fallback, returned whenever no candidate beats its triangle count
+inline int AdaptiveSurfaceSamples(
+    std::vector<double>& profile_samples,
+    glm::dvec2(*parametric_line)(double),
+    double tolerance,
+    double angle_tolerance,
+    int uniform_vertical_segments,
+    int uniform_rotation_segments
+)
+{
+    profile_samples = UniformProfileSamples(uniform_vertical_segments);
+    int rotation_segments = uniform_rotation_segments;
+    double triangles = double(uniform_vertical_segments - 1) * uniform_rotation_segments;
+
+    for (int i = 1; i < 10; ++i)
+    {
+        auto profile_tolerance = tolerance * i / 10;
+        auto rotation_tolerance = tolerance - profile_tolerance;
+        for (int attempt = 0; attempt < 4; ++attempt)
+        {
+            auto samples = AdaptiveProfileSamples(parametric_line, profile_tolerance, angle_tolerance);
+            auto segments = AdaptiveRotationSegments(ProfileRadius(parametric_line, samples), rotation_tolerance, angle_tolerance);
+
+            //tightening only adds triangles, so a candidate that already loses is done
+            auto candidate_triangles = double(samples.size() - 1) * segments;
+            if (candidate_triangles >= triangles)
+                break;
+
+            auto error = SampledSurfaceError(parametric_line, samples, segments);
+            if (error <= tolerance)
+            {
+                profile_samples.swap(samples);
+                rotation_segments = segments;
+                triangles = candidate_triangles;
+                break;
+            }
+
+            //a little past the overshoot, so the next attempt is likely to hold
+            auto shrink = tolerance / error * 0.95;
+            profile_tolerance *= shrink;
+            rotation_tolerance *= shrink;
+        }
+    }
+    return rotation_segments;
+}
+
+//GenerateParametricPositions and GenerateParametricNormals for a non-uniform set of t values,
+//the grid has profile_samples.size() vertical segments
+inline void GenerateSampledPositions(
+    glm::vec3* positions,
+    glm::dvec2(*parametric_line)(double),
+    const std::vector<double>& profile_samples,
+    int rotation_segments,
+    int r_begin,
+    int r_end
+)
+{
+    positions += size_t(r_begin) * profile_samples.size();
+    for (int r = r_begin; r < r_end; ++r)
+        for (auto t : profile_samples)
+            *positions++ = ParametricSurface(parametric_line, t, r / double(rotation_segments));
+}
+
+inline void GenerateSampledNormals(
+    glm::vec3* normals,
+    glm::dvec2(*parametric_line)(double),
+    const std::vector<double>& profile_samples,
+    int rotation_segments,
+    int r_begin,
+    int r_end
+)
+{
+    auto last = profile_samples.size() - 1;
+    auto epsilonr = 1 / double(rotation_segments);
+
+    normals += size_t(r_begin) * profile_samples.size();
+    for (int r = r_begin; r < r_end; ++r)
+        for (size_t v = 0; v <= last; ++v)
+        {
+            auto nr = r / double(rotation_segments);
+
+            //the neighbouring samples, mirrored past both ends like the uniform generator does
+            auto t = profile_samples[v];
+            auto prev_t = v > 0 ? profile_samples[v - 1] : 2 * t - profile_samples[1];
+            auto next_t = v < last ? profile_samples[v + 1] : 2 * t - profile_samples[last - 1];
+
+            auto tangent_v = (ParametricSurface(parametric_line, next_t, nr) - ParametricSurface(parametric_line, prev_t, nr)) / 2.;
+            auto tangent_r = (ParametricSurface(parametric_line, t, nr + epsilonr) - ParametricSurface(parametric_line, t, nr - epsilonr)) / 2.;
+
+            *normals++ = glm::normalize(glm::cross(tangent_r, tangent_v));
+        }
+}
+
+/* Scene Transforms */
+//the four shapes of scenes 0-4 on a 2x2 grid, all spinning around (1, 1, 0)
+inline void GridTransforms(double time, glm::mat4& transform, glm::mat4& transform2, glm::mat4& transform3, glm::mat4& transform4)
+{
+    transform = glm::mat4(1.0);
+    transform = glm::scale(transform, glm::vec3(0.4));
+
+    transform  = glm::translate(transform,  glm::vec3(1.2,1.2,0));
+    transform3 = glm::translate(transform,  glm::vec3(0,-2.4,-0));
+    transform2 = glm::translate(transform,  glm::vec3(-2.2,0.0,0));
+    transform4 = glm::translate(transform,  glm::vec3(-2.1,-2.3,0));
+
+    transform  = glm::rotate(transform,  glm::radians(float(time * 10)), glm::vec3(1, 1, 0));
+    transform2 = glm::rotate(transform2, glm::radians(float(time * 10)), glm::vec3(1, 1, 0));
+    transform3 = glm::rotate(transform3, glm::radians(float(time * 10)), glm::vec3(1, 1, 0));
+    transform4 = glm::rotate(transform4, glm::radians(float(time * 10)), glm::vec3(1, 1, 0));
+}
@@ -0,0 +1,462 @@
+#pragma once
+/* Mouse picking, a SAH bounding volume hierarchy over a triangle mesh. Needs no OpenGL context */
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "GLM/glm.hpp"
+#include "glad.h"
+
+/* Mesh BVH */
+//interior nodes have count 0 and their children at first and first + 1,
+//leaves hold triangles [first, first + count) of MeshBVH::triangles
+struct BVHNode
+{
+    glm::vec3 min;
+    uint32_t first;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+struct MeshBVH
+{
+    std::vector<glm::vec3> positions;
+    std::vector<GLuint> indices;
+    //set by DropGridIndices, the triangles then follow the layout of GenerateGridIndices and indices is empty
+    int grid_vertical_segments = 0;
+    int grid_rotation_segments = 0;
+
+    //triangle numbers in leaf order
+    std::vector<uint32_t> triangles;
+    std::vector<BVHNode> nodes;
+};
+
+struct RayHit
+{
+    bool hit = false;
+    uint32_t triangle = 0;
+    //along the ray, the ray's direction is not normalized
+    float t = 0;
+    //weights of the triangle's second and third vertex
+    glm::vec2 barycentric;
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+//runs fn over [0, count) split into ranges, possibly on several threads
+typedef std::function<void(int, const std::function<void(int, int)>&)> ParallelForFunction;
+
+inline void SerialFor(int count, const std::function<void(int, int)>& fn)
+{
+    fn(0, count);
+}
+
+//bounds of one triangle, the build bins them by their centers
+struct TriangleBounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    glm::vec3 Center2() const
+    {
+        return min + max;
+    }
+};
+
+//the vertices of a triangle of GenerateGridIndices, two per quad, the last row wraps around to the first
+inline void GridTriangleIndices(int vertical_segments, int rotation_segments, uint32_t triangle, GLuint& i0, GLuint& i1, GLuint& i2)
+{
+    auto quad = triangle / 2;
+    auto r = quad / uint32_t(vertical_segments - 1);
+    auto v = quad % uint32_t(vertical_segments - 1);
+    auto row = GLuint(r * vertical_segments + v);
+    auto next_row = GLuint((r + 1) % uint32_t(rotation_segments) * vertical_segments + v);
+    i0 = row + 1;
+    i1 = triangle % 2 == 0 ? next_row : next_row + 1;
+    i2 = triangle % 2 == 0 ? row : next_row;
+}
+
+inline void TriangleVertices(const MeshBVH& bvh, uint32_t triangle, glm::vec3& a, glm::vec3& b, glm::vec3& c)
+{
+    if (bvh.indices.empty())
+    {
+        GLuint i0, i1, i2;
+        GridTriangleIndices(bvh.grid_vertical_segments, bvh.grid_rotation_segments, triangle, i0, i1, i2);
+        a = bvh.positions[i0];
+        b = bvh.positions[i1];
+        c = bvh.positions[i2];
+        return;
+    }
+
+    a = bvh.positions[bvh.indices[triangle * 3]];
+    b = bvh.positions[bvh.indices[triangle * 3 + 1]];
+    c = bvh.positions[bvh.indices[triangle * 3 + 2]];
+}
+
+inline float SurfaceArea(glm::vec3 min, glm::vec3 max)
+{
+    auto e = glm::max(max - min, glm::vec3(0));
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+//grows node to the bounds of its triangles
+inline void FitNode(const MeshBVH& bvh, const std::vector<TriangleBounds>& bounds, BVHNode& node, uint32_t begin, uint32_t end)
+{
+    node.min = glm::vec3(1e30f);
+    node.max = glm::vec3(-1e30f);
+    for (auto i = begin; i < end; ++i)
+    {
+        node.min = glm::min(node.min, bounds[bvh.triangles[i]].min);
+        node.max = glm::max(node.max, bounds[bvh.triangles[i]].max);
+    }
+}
+
+//binned SAH split of triangles [begin, end), returns the partition point or begin if a leaf is cheaper.
+//the bounds of both sides come back in left and right
+inline uint32_t SplitNode(
+    MeshBVH& bvh, const std::vector<TriangleBounds>& bounds, const BVHNode& node, uint32_t begin, uint32_t end,
+    BVHNode& left, BVHNode& right
+)
+{
+    const int bin_count = 12;
+    const uint32_t max_leaf_size = 8;
+
+    //splitting two triangles never pays off
+    if (end - begin <= 2)
+        return begin;
+
+    //centers are kept doubled, it makes no difference to the binning
+    auto center_min = glm::vec3(1e30f);
+    auto center_max = glm::vec3(-1e30f);
+    for (auto i = begin; i < end; ++i)
+    {
+        auto center = bounds[bvh.triangles[i]].Center2();
+        center_min = glm::min(center_min, center);
+        center_max = glm::max(center_max, center);
+    }
+
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        auto extent = center_max[axis] - center_min[axis];
+        scale[axis] = extent > 0 ? bin_count / extent : 0;
+    }
+
+    //all three axes are binned in one pass over the triangles
+    glm::vec3 bin_min[3][bin_count], bin_max[3][bin_count];
+    uint32_t bin_triangles[3][bin_count] = {};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        std::fill(bin_min[axis], bin_min[axis] + bin_count, glm::vec3(1e30f));
+        std::fill(bin_max[axis], bin_max[axis] + bin_count, glm::vec3(-1e30f));
+    }
+
+    for (auto i = begin; i < end; ++i)
+    {
+        const auto& triangle = bounds[bvh.triangles[i]];
+        auto center = triangle.Center2();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            auto bin = std::min(bin_count - 1, int((center[axis] - center_min[axis]) * scale[axis]));
+            bin_min[axis][bin] = glm::min(bin_min[axis][bin], triangle.min);
+            bin_max[axis][bin] = glm::max(bin_max[axis][bin], triangle.max);
+            ++bin_triangles[axis][bin];
+        }
+    }
+
+    int best_axis = -1;
+    int best_bin = 0;
+    //traversal costs as much as one triangle test
+    float best_cost = float(end - begin) - 1;
+    float forced_cost = 1e30f;
+    int forced_axis = -1, forced_bin = 0;
+    BVHNode forced_left = {}, forced_right = {};
+    auto node_area = std::max(SurfaceArea(node.min, node.max), 1e-30f);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (scale[axis] == 0)
+            continue;
+
+        //bounds and counts left of each split plane, then sweep from the right
+        glm::vec3 left_min[bin_count - 1], left_max[bin_count - 1];
+        uint32_t left_count[bin_count - 1];
+        auto sweep_min = glm::vec3(1e30f), sweep_max = glm::vec3(-1e30f);
+        uint32_t sweep_count = 0;
+        for (int bin = 0; bin < bin_count - 1; ++bin)
+        {
+            sweep_min = glm::min(sweep_min, bin_min[axis][bin]);
+            sweep_max = glm::max(sweep_max, bin_max[axis][bin]);
+            sweep_count += bin_triangles[axis][bin];
+            left_min[bin] = sweep_min;
+            left_max[bin] = sweep_max;
+            left_count[bin] = sweep_count;
+        }
+
+        sweep_min = glm::vec3(1e30f);
+        sweep_max = glm::vec3(-1e30f);
+        sweep_count = 0;
+        for (int bin = bin_count - 1; bin > 0; --bin)
+        {
+            sweep_min = glm::min(sweep_min, bin_min[axis][bin]);
+            sweep_max = glm::max(sweep_max, bin_max[axis][bin]);
+            sweep_count += bin_triangles[axis][bin];
+            if (sweep_count == 0 || left_count[bin - 1] == 0)
+                continue;
+
+            auto cost = (SurfaceArea(left_min[bin - 1], left_max[bin - 1]) * left_count[bin - 1] +
+                         SurfaceArea(sweep_min, sweep_max) * sweep_count) / node_area;
+            if (cost < forced_cost)
+            {
+                forced_cost = cost;
+                forced_axis = axis;
+                forced_bin = bin;
+                forced_left = { left_min[bin - 1], 0, left_max[bin - 1], 0 };
+                forced_right = { sweep_min, 0, sweep_max, 0 };
+            }
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = bin;
+                left = { left_min[bin - 1], 0, left_max[bin - 1], 0 };
+                right = { sweep_min, 0, sweep_max, 0 };
+            }
+        }
+    }
+
+    //big leaves get split even when SAH says otherwise, to bound the query time
+    if (best_axis == -1 && end - begin > max_leaf_size)
+    {
+        best_axis = forced_axis;
+        best_bin = forced_bin;
+        left = forced_left;
+        right = forced_right;
+    }
+    if (best_axis == -1)
+        return begin;
+
+    //binned exactly like above, so neither side comes out empty
+    auto middle = std::partition(bvh.triangles.begin() + begin, bvh.triangles.begin() + end, [&](uint32_t triangle)
+    {
+        auto center = bounds[triangle].Center2();
+        return std::min(bin_count - 1, int((center[best_axis] - center_min[best_axis]) * scale[best_axis])) < best_bin;
+    });
+    return uint32_t(middle - bvh.triangles.begin());
+}
+
+//deeper nodes stay leaves, however many triangles they hold. Clustered or degenerate triangles can keep the
+//SAH splitting off a few at a time, and the traversal stack only has room for a path this long
+const int max_bvh_depth = 64;
+
+//builds the subtree of triangles [begin, end) into nodes[index], which already has their bounds.
+//subtrees at depth stop_depth are left as leaves and recorded in deferred so they can be built separately
+inline void BuildSubtree(
+    MeshBVH& bvh, std::vector<BVHNode>& nodes, const std::vector<TriangleBounds>& bounds,
+    uint32_t index, uint32_t begin, uint32_t end, int depth, int stop_depth, std::vector<uint32_t>* deferred
+)
+{
+    nodes[index].first = begin;
+    nodes[index].count = end - begin;
+
+    if (depth == stop_depth && deferred != NULL)
+    {
+        deferred->push_back(index);
+        return;
+    }
+    if (depth >= max_bvh_depth)
+        return;
+
+    BVHNode left, right;
+    auto middle = SplitNode(bvh, bounds, nodes[index], begin, end, left, right);
+    if (middle == begin || middle == end)
+        return;
+
+    auto first = uint32_t(nodes.size());
+    nodes[index].first = first;
+    nodes[index].count = 0;
+    nodes.push_back(left);
+    nodes.push_back(right);
+
+    BuildSubtree(bvh, nodes, bounds, first, begin, middle, depth + 1, stop_depth, deferred);
+    BuildSubtree(bvh, nodes, bounds, first + 1, middle, end, depth + 1, stop_depth, deferred);
+}
+
+//builds the hierarchy over bvh.positions and bvh.indices. The top levels are split on the calling thread,
+//the subtrees below them are built in parallel and appended
+inline void BuildMeshBVH(MeshBVH& bvh, const ParallelForFunction& parallel_for = SerialFor, int top_depth = 6)
+{
+    auto triangle_count = uint32_t(bvh.indices.size() / 3);
+    bvh.triangles.resize(triangle_count);
+    std::vector<TriangleBounds> bounds(triangle_count);
+    parallel_for(int(triangle_count), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            glm::vec3 a, b, c;
+            TriangleVertices(bvh, uint32_t(i), a, b, c);
+            bounds[i] = { glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c)) };
+            bvh.triangles[i] = uint32_t(i);
+        }
+    });
+
+    bvh.nodes.assign(1, BVHNode());
+    FitNode(bvh, bounds, bvh.nodes[0], 0, triangle_count);
+    if (triangle_count == 0)
+    {
+        bvh.nodes[0] = { glm::vec3(0), 0, glm::vec3(0), 0 };
+        return;
+    }
+
+    std::vector<uint32_t> deferred;
+    BuildSubtree(bvh, bvh.nodes, bounds, 0, 0, triangle_count, 0, top_depth, &deferred);
+
+    std::vector<std::vector<BVHNode>> subtrees(deferred.size());
+    parallel_for(int(deferred.size()), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const auto& leaf = bvh.nodes[deferred[i]];
+            subtrees[i].assign(1, leaf);
+            //at the depth of its placeholder, so the limit holds for the whole tree
+            BuildSubtree(bvh, subtrees[i], bounds, 0, leaf.first, leaf.first + leaf.count, top_depth, -1, NULL);
+        }
+    });
+
+    //the subtree roots replace their placeholder leaves, their children move behind the top levels
+    for (size_t i = 0; i < deferred.size(); ++i)
+    {
+        auto offset = uint32_t(bvh.nodes.size()) - 1;
+        for (auto& node : subtrees[i])
+            if (node.count == 0)
+                node.first += offset;
+
+        bvh.nodes[deferred[i]] = subtrees[i][0];
+        bvh.nodes.insert(bvh.nodes.end(), subtrees[i].begin() + 1, subtrees[i].end());
+    }
+}
+
+//once the nodes exist the indices of a grid mesh are redundant. Drops them when they match the layout of
+//GenerateGridIndices, returns false and keeps them otherwise
+inline bool DropGridIndices(MeshBVH& bvh, int vertical_segments, int rotation_segments)
+{
+    if (vertical_segments < 2 || rotation_segments < 1 || bvh.indices.size() != size_t(vertical_segments - 1) * rotation_segments * 6)
+        return false;
+
+    for (uint32_t triangle = 0; triangle < bvh.indices.size() / 3; ++triangle)
+    {
+        GLuint i0, i1, i2;
+        GridTriangleIndices(vertical_segments, rotation_segments, triangle, i0, i1, i2);
+        if (bvh.indices[triangle * 3] != i0 || bvh.indices[triangle * 3 + 1] != i1 || bvh.indices[triangle * 3 + 2] != i2)
+            return false;
+    }
+
+    std::vector<GLuint>().swap(bvh.indices);
+    bvh.grid_vertical_segments = vertical_segments;
+    bvh.grid_rotation_segments = rotation_segments;
+    return true;
+}
+
+/* Queries */
+//distance along the ray to the box, or a negative value if it misses within [0, t_max]
+inline float RayBoxDistance(glm::vec3 origin, glm::vec3 inverse_direction, glm::vec3 min, glm::vec3 max, float t_max)
+{
+    auto t0 = (min - origin) * inverse_direction;
+    auto t1 = (max - origin) * inverse_direction;
+    auto near = glm::min(t0, t1);
+    auto far = glm::max(t0, t1);
+    auto t_enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.f));
+    auto t_exit = std::min(std::min(far.x, far.y), std::min(far.z, t_max));
+    return t_enter <= t_exit ? t_enter : -1;
+}
+
+//closest hit with t in [0, t_max] of the ray origin + t * direction, both sides of the triangles count
+inline RayHit IntersectMeshBVH(const MeshBVH& bvh, glm::vec3 origin, glm::vec3 direction, float t_max = 1e30f)
+{
+    RayHit result;
+    result.t = t_max;
+    if (bvh.nodes.empty() || bvh.triangles.empty())
+        return result;
+
+    //keeps the slab test free of 0 * inf
+    for (int axis = 0; axis < 3; ++axis)
+        if (std::abs(direction[axis]) < 1e-20f)
+            direction[axis] = 1e-20f;
+    auto inverse_direction = 1.f / direction;
+
+    //a path from the root is at most max_bvh_depth + 1 nodes and the stack holds one sibling per level on it
+    uint32_t stack[max_bvh_depth + 2];
+    int stack_size = 0;
+    if (RayBoxDistance(origin, inverse_direction, bvh.nodes[0].min, bvh.nodes[0].max, result.t) >= 0)
+        stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const auto& node = bvh.nodes[stack[--stack_size]];
+        if (node.count > 0)
+        {
+            for (auto i = node.first; i < node.first + node.count; ++i)
+            {
+                //Moller-Trumbore
+                glm::vec3 a, b, c;
+                TriangleVertices(bvh, bvh.triangles[i], a, b, c);
+                auto e1 = b - a;
+                auto e2 = c - a;
+                auto p = glm::cross(direction, e2);
+                auto determinant = glm::dot(e1, p);
+                if (std::abs(determinant) < 1e-12f)
+                    continue;
+
+                auto inverse_determinant = 1 / determinant;
+                auto s = origin - a;
+                auto u = glm::dot(s, p) * inverse_determinant;
+                if (u < 0 || u > 1)
+                    continue;
+                auto q = glm::cross(s, e1);
+                auto v = glm::dot(direction, q) * inverse_determinant;
+                if (v < 0 || u + v > 1)
+                    continue;
+                auto t = glm::dot(e2, q) * inverse_determinant;
+                if (t < 0 || t >= result.t)
+                    continue;
+
+                result.hit = true;
+                result.triangle = bvh.triangles[i];
+                result.t = t;
+                result.barycentric = glm::vec2(u, v);
+                result.normal = glm::cross(e1, e2);
+            }
+            continue;
+        }
+
+        //nearer child on top of the stack, children further than the best hit are skipped
+        auto left = RayBoxDistance(origin, inverse_direction, bvh.nodes[node.first].min, bvh.nodes[node.first].max, result.t);
+        auto right = RayBoxDistance(origin, inverse_direction, bvh.nodes[node.first + 1].min, bvh.nodes[node.first + 1].max, result.t);
+        if (left >= 0 && right >= 0)
+        {
+            stack[stack_size++] = left < right ? node.first + 1 : node.first;
+            stack[stack_size++] = left < right ? node.first : node.first + 1;
+        }
+        else if (left >= 0)
+            stack[stack_size++] = node.first;
+        else if (right >= 0)
+            stack[stack_size++] = node.first + 1;
+    }
+
+    if (result.hit)
+    {
+        result.position = origin + direction * result.t;
+        //facing the ray
+        result.normal = glm::normalize(glm::dot(result.normal, direction) > 0 ? -result.normal : result.normal);
+    }
+    return result;
+}
+
+//ray under a cursor at ndc, for a mesh drawn with gl_Position = transform * position and no projection,
+//in the mesh's own space. t runs from the near to the far plane over [0, 1]
+inline void CursorRay(const glm::mat4& transform, glm::vec2 ndc, glm::vec3& origin, glm::vec3& direction)
+{
+    auto inverse = glm::inverse(transform);
+    origin = glm::vec3(inverse * glm::vec4(ndc, -1, 1));
+    direction = glm::vec3(inverse * glm::vec4(0, 0, 2, 0));
+}